@@ -0,0 +1,443 @@
+#define _GNU_SOURCE
+
+#include "bench.h"
+#include "codec.h"
+#include "dispatch.h"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/perf_event.h>)
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#if defined(__NR_perf_event_open)
+#define HUFFMAN_HAVE_PERF 1
+#endif
+#endif
+#endif
+
+static const char* bench_stage_names[HUFFMAN_BENCH_STAGES] = {
+    "histogram", "build", "encode", "decode"
+};
+
+/*
+ * One descriptor per counter, -1 for those the kernel refused, and what
+ * each read as [value, time enabled, time running] when it was started.
+ */
+struct bench_counters_s
+{
+    int fd[HUFFMAN_BENCH_COUNTERS];
+    uint64_t start[HUFFMAN_BENCH_COUNTERS][3];
+};
+
+typedef struct bench_counters_s bench_counters_t;
+
+#ifdef HUFFMAN_HAVE_PERF
+static int bench_counter_open(int counter)
+{
+    struct perf_event_attr attr;
+    
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+        PERF_FORMAT_TOTAL_TIME_RUNNING;
+    
+    switch (counter)
+    {
+    case HUFFMAN_BENCH_CYCLES:
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    
+    case HUFFMAN_BENCH_INSTRUCTIONS:
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    
+    case HUFFMAN_BENCH_BRANCH_MISSES:
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    
+    case HUFFMAN_BENCH_L1D_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D |
+            PERF_COUNT_HW_CACHE_OP_READ << 8 |
+            PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+        break;
+    
+    case HUFFMAN_BENCH_LLC_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_LL |
+            PERF_COUNT_HW_CACHE_OP_READ << 8 |
+            PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+        break;
+    
+    default:
+        return -1;
+    }
+    
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+static void bench_counters_open(bench_counters_t* c)
+{
+    int i = 0;
+    
+    for (i = 0; i < HUFFMAN_BENCH_COUNTERS; i++)
+    {
+#ifdef HUFFMAN_HAVE_PERF
+        c->fd[i] = bench_counter_open(i);
+#else
+        c->fd[i] = -1;
+#endif
+    }
+}
+
+static void bench_counters_close(bench_counters_t* c)
+{
+    int i = 0;
+    
+    for (i = 0; i < HUFFMAN_BENCH_COUNTERS; i++)
+    {
+        if (c->fd[i] >= 0)
+            close(c->fd[i]);
+    }
+}
+
+/*
+ * The enabled and running times are not cleared by a reset, so rather
+ * than resetting, every counter is read at the start and the stop works
+ * on the differences.
+ */
+static void bench_counters_start(bench_counters_t* c)
+{
+#ifdef HUFFMAN_HAVE_PERF
+    int i = 0;
+    
+    for (i = 0; i < HUFFMAN_BENCH_COUNTERS; i++)
+    {
+        if (c->fd[i] < 0)
+            continue;
+        
+        if (sizeof(c->start[i]) !=
+            read(c->fd[i], c->start[i], sizeof(c->start[i])))
+            memset(c->start[i], 0, sizeof(c->start[i]));
+    }
+    
+    for (i = 0; i < HUFFMAN_BENCH_COUNTERS; i++)
+    {
+        if (c->fd[i] >= 0)
+            ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    (void) c;
+#endif
+}
+
+/*
+ * Adds what each counter saw since bench_counters_start() to totals.
+ * Counters the PMU had to multiplex are scaled up to the full interval
+ * by the share of it they were running, -1 if they never ran.
+ */
+static void bench_counters_stop(bench_counters_t* c, int64_t* totals)
+{
+#ifdef HUFFMAN_HAVE_PERF
+    uint64_t values[3];
+    int i = 0;
+    
+    for (i = 0; i < HUFFMAN_BENCH_COUNTERS; i++)
+    {
+        if (c->fd[i] >= 0)
+            ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+    
+    for (i = 0; i < HUFFMAN_BENCH_COUNTERS; i++)
+    {
+        double value = 0.0;
+        uint64_t enabled = 0, running = 0;
+        
+        if (c->fd[i] < 0 ||
+            sizeof(values) != read(c->fd[i], values, sizeof(values)))
+            continue;
+        
+        value = (double) (values[0] - c->start[i][0]);
+        enabled = values[1] - c->start[i][1];
+        running = values[2] - c->start[i][2];
+        if (0 == running && 0 != enabled)
+            totals[i] = -1;
+        
+        if (totals[i] < 0)
+            continue;
+        
+        if (running < enabled)
+            value *= (double) enabled / (double) running;
+        
+        totals[i] += (int64_t) value;
+    }
+#else
+    (void) c;
+    (void) totals;
+#endif
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+const char* huffman_bench_stage_name(int stage)
+{
+    if (stage < 0 || stage >= HUFFMAN_BENCH_STAGES)
+        return "unknown";
+    
+    return bench_stage_names[stage];
+}
+
+/* Per block state, in flat arrays the code tables are views into. */
+struct bench_state_s
+{
+    size_t block_size;
+    size_t blocks;
+    size_t bound;
+    chartab_t** tabs;
+    uint8_t* lengths;
+    uint32_t* codes;
+    int* max_lengths;
+    uint8_t* payload;
+    size_t* payload_sizes;
+    uint8_t* decoded;
+    huffman_decoder_t* dec;
+};
+
+typedef struct bench_state_s bench_state_t;
+
+static void bench_state_free(bench_state_t* st)
+{
+    size_t b = 0;
+    
+    if (NULL != st->tabs)
+    {
+        for (b = 0; b < st->blocks; b++)
+            chartab_free(st->tabs[b]);
+    }
+    
+    free(st->tabs);
+    free(st->lengths);
+    free(st->codes);
+    free(st->max_lengths);
+    free(st->payload);
+    free(st->payload_sizes);
+    free(st->decoded);
+    huffman_decoder_free(st->dec);
+}
+
+static int bench_state_init(bench_state_t* st, size_t size, size_t block_size)
+{
+    size_t b = 0;
+    
+    memset(st, 0, sizeof(bench_state_t));
+    st->block_size = block_size;
+    st->blocks = (size + block_size - 1) / block_size;
+    st->bound = huffman_encode_bound(block_size);
+    
+    st->tabs = (chartab_t**) calloc(st->blocks + 1, sizeof(chartab_t*));
+    st->lengths = (uint8_t*)
+        malloc((st->blocks + 1) * HUFFMAN_ASCII_BYTE_CHARTAB_SIZE);
+    st->codes = (uint32_t*) malloc((st->blocks + 1) *
+        HUFFMAN_ASCII_BYTE_CHARTAB_SIZE * sizeof(uint32_t));
+    st->max_lengths = (int*) calloc(st->blocks + 1, sizeof(int));
+    st->payload = (uint8_t*) malloc((st->blocks + 1) * st->bound);
+    st->payload_sizes = (size_t*) malloc((st->blocks + 1) * sizeof(size_t));
+    st->decoded = (uint8_t*) malloc(size + 1);
+    st->dec = huffman_decoder_create();
+    if (NULL == st->tabs || NULL == st->lengths || NULL == st->codes ||
+        NULL == st->max_lengths || NULL == st->payload ||
+        NULL == st->payload_sizes || NULL == st->decoded || NULL == st->dec)
+        return -7;
+    
+    for (b = 0; b < st->blocks; b++)
+    {
+        st->tabs[b] = chartab_create(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE);
+        if (NULL == st->tabs[b])
+            return -7;
+    }
+    
+    return 0;
+}
+
+/* Runs one stage over every block, so each is measured on its own. */
+static int bench_stage(
+    bench_state_t* st,
+    int stage,
+    const uint8_t* data,
+    size_t size
+)
+{
+    size_t b = 0;
+    
+    for (b = 0; b < st->blocks; b++)
+    {
+        size_t offset = b * st->block_size;
+        size_t n = size - offset < st->block_size ?
+            size - offset : st->block_size;
+        uint8_t* payload = st->payload + b * st->bound;
+        huffman_codetab_t ct;
+        bitwriter_t bw;
+        bitreader_t br;
+        
+        ct.size = HUFFMAN_ASCII_BYTE_CHARTAB_SIZE;
+        ct.max_length = st->max_lengths[b];
+        ct.lengths = st->lengths + b * HUFFMAN_ASCII_BYTE_CHARTAB_SIZE;
+        ct.codes = st->codes + b * HUFFMAN_ASCII_BYTE_CHARTAB_SIZE;
+        
+        switch (stage)
+        {
+        case HUFFMAN_BENCH_HISTOGRAM:
+            chartab_clear(st->tabs[b]);
+            chartab_accumulate(st->tabs[b], data + offset, n);
+            break;
+        
+        case HUFFMAN_BENCH_BUILD:
+            if (0 != huffman_codetab_build(&ct, st->tabs[b],
+                                           HUFFMAN_MAX_CODE_LENGTH))
+                return -4;
+            
+            st->max_lengths[b] = ct.max_length;
+            break;
+        
+        case HUFFMAN_BENCH_ENCODE:
+            bitwriter_init(&bw, payload, st->bound);
+            if (0 != huffman_encode_symbols(&ct, data + offset, n, &bw) ||
+                0 != bitwriter_flush(&bw))
+                return -6;
+            
+            st->payload_sizes[b] = bw.pos;
+            break;
+        
+        default:
+            bitreader_init(&br, payload, st->payload_sizes[b], 0);
+            if (0 != huffman_decoder_build(st->dec, &ct) ||
+                0 != huffman_decode_symbols(st->dec, &br,
+                                            st->decoded + offset, n))
+                return -10;
+            break;
+        }
+    }
+    
+    return 0;
+}
+
+int huffman_bench_run(
+    const huffman_bench_config_t* config,
+    const uint8_t* data,
+    size_t size,
+    huffman_bench_result_t* result
+)
+{
+    bench_counters_t counters;
+    bench_state_t st;
+    size_t block_size = HUFFMAN_DEFAULT_BLOCK_SIZE;
+    int iterations = HUFFMAN_BENCH_DEFAULT_ITERATIONS;
+    int it = 0, stage = 0, i = 0, ret = 0;
+    
+    if ((NULL == data && size > 0) || NULL == result)
+        return -1;
+    
+    if (NULL != config && config->block_size > 0)
+        block_size = config->block_size;
+    
+    if (NULL != config && config->iterations > 0)
+        iterations = config->iterations;
+    
+    if (block_size > HUFFMAN_MAX_BLOCK_SIZE)
+        return -1;
+    
+    ret = bench_state_init(&st, size, block_size);
+    bench_counters_open(&counters);
+    
+    memset(result, 0, sizeof(huffman_bench_result_t));
+    result->bytes = size * (size_t) iterations;
+    for (stage = 0; stage < HUFFMAN_BENCH_STAGES; stage++)
+    {
+        for (i = 0; i < HUFFMAN_BENCH_COUNTERS; i++)
+            result->counters[stage][i] = counters.fd[i] < 0 ? -1 : 0;
+    }
+    
+    for (it = 0; 0 == ret && it < iterations; it++)
+    {
+        for (stage = 0; 0 == ret && stage < HUFFMAN_BENCH_STAGES; stage++)
+        {
+            double start = bench_now();
+            
+            bench_counters_start(&counters);
+            ret = bench_stage(&st, stage, data, size);
+            bench_counters_stop(&counters, result->counters[stage]);
+            result->seconds[stage] += bench_now() - start;
+        }
+        
+        if (0 == ret && 0 != memcmp(data, st.decoded, size))
+            ret = -10;
+    }
+    
+    bench_counters_close(&counters);
+    bench_state_free(&st);
+    return ret;
+}
+
+static void bench_print_ratio(FILE* fp, int64_t num, double den)
+{
+    if (num < 0 || den <= 0.0)
+        fprintf(fp, " %10s", "-");
+    else
+        fprintf(fp, " %10.4f", (double) num / den);
+}
+
+void huffman_bench_report(const huffman_bench_result_t* result, FILE* fp)
+{
+    double bytes = (double) result->bytes;
+    int stage = 0, i = 0, counted = 0;
+    
+    fprintf(fp, "kernels %s, %lu bytes\n", huffman_kernels()->name,
+            (unsigned long) result->bytes);
+    fprintf(fp, "%-10s %10s %10s %10s %10s %10s %10s\n", "stage", "MB/s",
+            "cycles/B", "IPC", "brmiss/B", "L1miss/B", "LLCmiss/B");
+    
+    for (stage = 0; stage < HUFFMAN_BENCH_STAGES; stage++)
+    {
+        const int64_t* c = result->counters[stage];
+        double seconds = result->seconds[stage];
+        
+        fprintf(fp, "%-10s", huffman_bench_stage_name(stage));
+        if (seconds > 0.0)
+            fprintf(fp, " %10.1f", bytes / seconds / 1e6);
+        else
+            fprintf(fp, " %10s", "-");
+        
+        bench_print_ratio(fp, c[HUFFMAN_BENCH_CYCLES], bytes);
+        bench_print_ratio(fp, c[HUFFMAN_BENCH_INSTRUCTIONS],
+                          c[HUFFMAN_BENCH_CYCLES] > 0 ?
+                              (double) c[HUFFMAN_BENCH_CYCLES] : 0.0);
+        bench_print_ratio(fp, c[HUFFMAN_BENCH_BRANCH_MISSES], bytes);
+        bench_print_ratio(fp, c[HUFFMAN_BENCH_L1D_MISSES], bytes);
+        bench_print_ratio(fp, c[HUFFMAN_BENCH_LLC_MISSES], bytes);
+        fprintf(fp, "\n");
+    }
+    
+    for (i = 0; i < HUFFMAN_BENCH_COUNTERS; i++)
+    {
+        if (result->counters[0][i] >= 0)
+            counted += 1;
+    }
+    
+    if (0 == counted)
+        fprintf(fp, "hardware counters unavailable, timings only\n");
+}
@@ -0,0 +1,66 @@
+#ifndef ___huffman__bench_h___
+#define ___huffman__bench_h___
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * Runs the block codec over a buffer one stage at a time, histogram,
+ * table build, encode and decode, and reports time and, where the kernel
+ * lets perf_event_open count them, cycles, instructions, branch misses
+ * and L1d and last level cache read misses of each stage. Counters that
+ * can not be opened are reported as "-", and without any the report is
+ * timings only.
+ */
+#define HUFFMAN_BENCH_DEFAULT_ITERATIONS    5
+
+enum
+{
+    HUFFMAN_BENCH_HISTOGRAM = 0,
+    HUFFMAN_BENCH_BUILD,
+    HUFFMAN_BENCH_ENCODE,
+    HUFFMAN_BENCH_DECODE,
+    HUFFMAN_BENCH_STAGES
+};
+
+enum
+{
+    HUFFMAN_BENCH_CYCLES = 0,
+    HUFFMAN_BENCH_INSTRUCTIONS,
+    HUFFMAN_BENCH_BRANCH_MISSES,
+    HUFFMAN_BENCH_L1D_MISSES,
+    HUFFMAN_BENCH_LLC_MISSES,
+    HUFFMAN_BENCH_COUNTERS
+};
+
+struct huffman_bench_config_s
+{
+    size_t block_size;
+    int iterations;
+};
+
+typedef struct huffman_bench_config_s huffman_bench_config_t;
+
+/* Totals over all iterations, a counter is -1 when it was not available. */
+struct huffman_bench_result_s
+{
+    size_t bytes;
+    double seconds[HUFFMAN_BENCH_STAGES];
+    int64_t counters[HUFFMAN_BENCH_STAGES][HUFFMAN_BENCH_COUNTERS];
+};
+
+typedef struct huffman_bench_result_s huffman_bench_result_t;
+
+const char* huffman_bench_stage_name(int stage);
+
+int huffman_bench_run(
+    const huffman_bench_config_t* config,
+    const uint8_t* data,
+    size_t size,
+    huffman_bench_result_t* result
+);
+
+void huffman_bench_report(const huffman_bench_result_t* result, FILE* fp);
+
+#endif
@@ -2,16 +2,26 @@
 
 #include <string.h>
 
+#define BINCODE_WORDS(bits) \
+    (((bits) + BINCODE_WORD_BITS - 1) / BINCODE_WORD_BITS)
+
+#define BINCODE_LOW_MASK(n) \
+    ((n) >= BINCODE_WORD_BITS ? ~(uint64_t) 0 : \
+        (((uint64_t) 1 << (n)) - 1))
+
 bincode_t* bincode_create(size_t size)
 {
     bincode_t* code = (bincode_t*) malloc(sizeof(bincode_t));
     if (NULL == code)
         return NULL;
     
-    code->size = size;
+    if (0 == size)
+        size = BINCODE_WORD_BITS;
+    
+    code->size = BINCODE_WORDS(size) * BINCODE_WORD_BITS;
     code->length = 0;
     
-    if (NULL == (code->bits = bincode_bit_alloc(size)))
+    if (NULL == (code->words = bincode_word_alloc(BINCODE_WORDS(size))))
     {
         free(code);
         return NULL;
@@ -20,20 +30,20 @@ bincode_t* bincode_create(size_t size)
     return code;
 }
 
-uint8_t* bincode_bit_alloc(size_t length)
+uint64_t* bincode_word_alloc(size_t length)
 {
-    uint8_t* bits = malloc(sizeof(uint8_t) * length);
-    if (NULL == bits)
+    uint64_t* words = (uint64_t*) malloc(sizeof(uint64_t) * length);
+    if (NULL == words)
         return NULL;
     
-    memset(bits, 0, length * sizeof(uint8_t));
-    return bits;
+    memset(words, 0, length * sizeof(uint64_t));
+    return words;
 }
 
 int bincode_bit_realloc(bincode_t* code, size_t new_size)
 {
-    uint8_t* old_bits = NULL;
-    uint8_t* new_bits = NULL;
+    uint64_t* new_words = NULL;
+    size_t old_count = 0, new_count = 0;
     
     if (NULL == code)
         return -1;
@@ -41,59 +51,125 @@ int bincode_bit_realloc(bincode_t* code, size_t new_size)
     if (new_size <= code->size)
         return -2;
     
-    if (NULL == (new_bits = bincode_bit_alloc(new_size)))
+    old_count = BINCODE_WORDS(code->size);
+    new_count = BINCODE_WORDS(new_size);
+    new_words = (uint64_t*) realloc(code->words, new_count * sizeof(uint64_t));
+    if (NULL == new_words)
         return -3;
     
-    old_bits = code->bits;
-    if (NULL != old_bits)
-    {
-        memcpy(new_bits, old_bits, code->length);
-        free(old_bits);
-    }
-    
-    code->size = new_size;
-    code->bits = new_bits;
+    memset(new_words + old_count, 0,
+           (new_count - old_count) * sizeof(uint64_t));
+    code->size = new_count * BINCODE_WORD_BITS;
+    code->words = new_words;
     return 0;
 }
 
+/* Make room for nbits more bits, growing geometrically. */
+static int bincode_reserve(bincode_t* code, size_t nbits)
+{
+    size_t new_size = code->size;
+    
+    if (code->length + nbits <= code->size)
+        return 0;
+    
+    while (new_size < code->length + nbits)
+        new_size = new_size * 2 + BINCODE_WORD_BITS;
+    
+    return bincode_bit_realloc(code, new_size);
+}
+
 int bincode_bit_append(bincode_t* code, int bit)
 {
-    if (NULL == code || NULL == code->bits)
+    return bincode_bits_append(code, BINCODE_1 == bit ? 1 : 0, 1);
+}
+
+int bincode_bits_append(bincode_t* code, uint64_t value, int nbits)
+{
+    size_t index = 0;
+    int offset = 0, room = 0;
+    
+    if (NULL == code || NULL == code->words)
         return -1;
     
-    if (code->length == code->size)
+    if (nbits < 0 || nbits > BINCODE_WORD_BITS)
+        return -3;
+    
+    if (0 == nbits)
+        return 0;
+    
+    if (0 != bincode_reserve(code, (size_t) nbits))
+        return -2;
+    
+    value &= BINCODE_LOW_MASK(nbits);
+    index = code->length / BINCODE_WORD_BITS;
+    offset = (int) (code->length % BINCODE_WORD_BITS);
+    room = BINCODE_WORD_BITS - offset;
+    
+    if (nbits <= room)
+        code->words[index] |= value << (room - nbits);
+    else
     {
-        size_t new_size = code->size + DEFAULT_BINCODE_SIZE;
-        if (0 != bincode_bit_realloc(code, new_size))
-            return -2;
+        code->words[index] |= value >> (nbits - room);
+        code->words[index + 1] |= value << (BINCODE_WORD_BITS - (nbits - room));
     }
     
-    code->bits[code->length] = bit;
-    code->length += 1;
+    code->length += (size_t) nbits;
     return 0;
 }
 
 int bincode_bit_pop(bincode_t* code)
 {
-    if (NULL == code || NULL == code->bits)
+    return bincode_bits_pop(code, 1);
+}
+
+int bincode_bits_pop(bincode_t* code, size_t nbits)
+{
+    size_t index = 0, old_length = 0;
+    int offset = 0;
+    
+    if (NULL == code || NULL == code->words)
         return -1;
     
-    if (code->length > 0)
+    if (nbits > code->length)
+        nbits = code->length;
+    
+    old_length = code->length;
+    code->length -= nbits;
+    index = code->length / BINCODE_WORD_BITS;
+    offset = (int) (code->length % BINCODE_WORD_BITS);
+    
+    /* Clear the tail of the last live word and every word after it. */
+    if (0 != offset)
     {
-        code->length -= 1;
-        code->bits[code->length] = BINCODE_0;
+        code->words[index] &= ~BINCODE_LOW_MASK(BINCODE_WORD_BITS - offset);
+        index += 1;
     }
     
+    for (; index < BINCODE_WORDS(old_length); index++)
+        code->words[index] = 0;
+    
     return 0;
 }
 
+int bincode_get_bit(const bincode_t* code, size_t index)
+{
+    uint64_t word = 0;
+    
+    if (NULL == code || NULL == code->words || index >= code->length)
+        return BINCODE_ERR;
+    
+    word = code->words[index / BINCODE_WORD_BITS];
+    return (int) (word >> (BINCODE_WORD_BITS - 1 - index % BINCODE_WORD_BITS))
+        & 1;
+}
+
 void bincode_free(bincode_t* code)
 {
     if (NULL == code)
         return;
     
-    if (NULL != code->bits)
-        free(code->bits);
+    if (NULL != code->words)
+        free(code->words);
     
     free(code);
     return;
@@ -114,7 +190,7 @@ int bincode_get_string(bincode_t* code, char* buf, size_t bufsize)
     
     for (i = 0; i < code->length; i++)
     {
-        if (BINCODE_0 == code->bits[i])
+        if (BINCODE_0 == bincode_get_bit(code, (size_t) i))
             buf[i] = '0';
         else
             buf[i] = '1';
@@ -203,7 +279,7 @@ int bitstream_set_bit(bitstream_t* bs, int bit)
     if (NULL == bs || NULL == bs->fd)
         return -1;
     
-    if (bs->bit_offset < 0 | bs->bit_offset >= 8)
+    if (bs->bit_offset < 0 || bs->bit_offset >= 8)
         return -2;
     
     if (BINCODE_0 == bit)
@@ -218,7 +294,7 @@ int bitstream_set_bit(bitstream_t* bs, int bit)
     bs->bit_offset += 1;
     if (bs->bit_offset >= 8)
     {
-        if (0 != fputc(bs->bit, bs->fd))
+        if (EOF == fputc(bs->bit, bs->fd))
             return -4;
         
         bs->bit = 0;
@@ -228,18 +304,77 @@ int bitstream_set_bit(bitstream_t* bs, int bit)
     return 0;
 }
 
+int bitstream_write_bits(bitstream_t* bs, uint64_t value, int nbits)
+{
+    if (NULL == bs || NULL == bs->fd)
+        return -1;
+    
+    if (bs->bit_offset < 0 || bs->bit_offset >= 8)
+        return -2;
+    
+    if (nbits < 0 || nbits > BINCODE_WORD_BITS)
+        return -3;
+    
+    /* Byte aligned whole word: emit it directly. */
+    if (0 == bs->bit_offset && BINCODE_WORD_BITS == nbits)
+    {
+        uint8_t bytes[8];
+        int i = 0;
+        
+        for (i = 0; i < 8; i++)
+            bytes[i] = (uint8_t) (value >> (56 - 8 * i));
+        
+        if (8 != fwrite(bytes, 1, 8, bs->fd))
+            return -4;
+        
+        return 0;
+    }
+    
+    while (nbits > 0)
+    {
+        int room = 8 - bs->bit_offset;
+        int take = nbits < room ? nbits : room;
+        int chunk = (int) ((value >> (nbits - take)) & ((1u << take) - 1));
+        
+        bs->bit |= chunk << (room - take);
+        bs->bit_offset += take;
+        nbits -= take;
+        
+        if (bs->bit_offset >= 8)
+        {
+            if (EOF == fputc(bs->bit, bs->fd))
+                return -4;
+            
+            bs->bit = 0;
+            bs->bit_offset = 0;
+        }
+    }
+    
+    return 0;
+}
+
 int bitstream_write_bincode(bitstream_t* bs, bincode_t* code)
 {
-    int i = 0;
+    size_t i = 0, full = 0;
+    int rest = 0, ret = 0;
     
-    if (NULL == code || NULL == code->bits)
+    if (NULL == code || NULL == code->words)
         return -1;
     
-    for (i = 0; i < code->length; i++)
+    full = code->length / BINCODE_WORD_BITS;
+    rest = (int) (code->length % BINCODE_WORD_BITS);
+    
+    for (i = 0; i < full; i++)
     {
-        int bit = code->bits[i];
-        int ret = bitstream_set_bit(bs, bit);
-        
+        ret = bitstream_write_bits(bs, code->words[i], BINCODE_WORD_BITS);
+        if (ret < 0)
+            return ret;
+    }
+    
+    if (rest > 0)
+    {
+        ret = bitstream_write_bits(bs,
+            code->words[full] >> (BINCODE_WORD_BITS - rest), rest);
         if (ret < 0)
             return ret;
     }
@@ -257,18 +392,128 @@ int bitstream_eof(bitstream_t* bs)
     
     if (0 != bs->eof)
         return 1;
-        
+    
     return 0;
 }
 
-void bitstream_close(bitstream_t* fd)
+int bitstream_close(bitstream_t* fd)
 {
-    if (NULL != fd)
+    int ret = 0;
+    
+    if (NULL == fd)
+        return 0;
+    
+    if (NULL != fd->fd)
     {
-        if (NULL != fd->fd)
-            fclose(fd->fd);
+        /* Partial last byte, zero padded. */
+        if (BITSTREAM_WRITE == fd->rw && fd->bit_offset > 0 &&
+            EOF == fputc(fd->bit, fd->fd))
+            ret = -1;
         
-        free(fd);
+        if (0 != fclose(fd->fd))
+            ret = -1;
     }
+    
+    free(fd);
+    return ret;
 }
 
+
+void bitwriter_init(bitwriter_t* bw, uint8_t* data, size_t size)
+{
+    bw->data = data;
+    bw->size = size;
+    bw->pos = 0;
+    bw->acc = 0;
+    bw->count = 0;
+    bw->overflow = 0;
+}
+
+void bitwriter_spill(bitwriter_t* bw)
+{
+    while (bw->count >= 8)
+    {
+        bw->count -= 8;
+        if (bw->pos < bw->size)
+            bw->data[bw->pos++] = (uint8_t) (bw->acc >> bw->count);
+        else
+            bw->overflow = 1;
+    }
+}
+
+int bitwriter_flush(bitwriter_t* bw)
+{
+    bitwriter_spill(bw);
+    if (bw->count > 0)
+    {
+        /* Pad the final partial byte with zero bits. */
+        bw->acc <<= 8 - bw->count;
+        bw->count = 8;
+        bitwriter_spill(bw);
+    }
+    
+    bw->acc = 0;
+    return bw->overflow ? -1 : 0;
+}
+
+void bitreader_init(
+    bitreader_t* br,
+    const uint8_t* data,
+    size_t size,
+    size_t bit_offset
+)
+{
+    br->data = data;
+    br->size = size;
+    br->pos = bit_offset / 8;
+    br->acc = 0;
+    br->count = 0;
+    
+    bitreader_refill(br);
+    if (bit_offset % 8)
+        BITREADER_CONSUME(br, (int) (bit_offset % 8));
+}
+
+static uint64_t load_be64(const uint8_t* p)
+{
+    return ((uint64_t) p[0] << 56) | ((uint64_t) p[1] << 48) |
+        ((uint64_t) p[2] << 40) | ((uint64_t) p[3] << 32) |
+        ((uint64_t) p[4] << 24) | ((uint64_t) p[5] << 16) |
+        ((uint64_t) p[6] << 8) | (uint64_t) p[7];
+}
+
+void bitreader_refill(bitreader_t* br)
+{
+    /*
+     * Whole word load when 8 bytes are left: top up to 56..63 bits. The
+     * bits below count are already the right ones, later loads OR the
+     * same values over them.
+     */
+    if (br->count <= 56 && br->pos + 8 <= br->size)
+    {
+        br->acc |= load_be64(br->data + br->pos) >> br->count;
+        br->pos += (size_t) ((63 - br->count) >> 3);
+        br->count |= 56;
+        return;
+    }
+    
+    /* Past the end of the buffer the reader sees zero bits. */
+    while (br->count <= 56)
+    {
+        uint64_t byte = br->pos < br->size ? br->data[br->pos] : 0;
+        
+        br->acc |= byte << (56 - br->count);
+        br->count += 8;
+        br->pos += 1;
+    }
+}
+
+size_t bitreader_tell(const bitreader_t* br)
+{
+    return br->pos * 8 - (size_t) br->count;
+}
+
+int bitreader_overrun(const bitreader_t* br)
+{
+    return bitreader_tell(br) > br->size * 8;
+}
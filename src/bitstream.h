@@ -11,35 +11,49 @@
 #define BINCODE_0    0
 #define BINCODE_1    1
 
+#define BINCODE_WORD_BITS 64
+
+/*
+ * Bits are packed MSB-first into 64-bit words: bit i of the code lives in
+ * words[i / 64] at position (63 - i % 64), so a whole word can be emitted
+ * to a bitstream as-is. size is the capacity in bits (a multiple of 64),
+ * length is the number of valid bits.
+ */
 struct bincode_s
 {
     size_t size;
     size_t length;
-    uint8_t* bits;
+    uint64_t* words;
 };
 
 typedef struct bincode_s bincode_t;
 
 bincode_t* bincode_create(size_t size);
 
-uint8_t* bincode_bit_alloc(size_t length_in_byte);
+uint64_t* bincode_word_alloc(size_t length_in_word);
 
 int bincode_bit_realloc(bincode_t* code, size_t new_size);
 
 int bincode_bit_append(bincode_t* code, int bit);
 
+int bincode_bits_append(bincode_t* code, uint64_t value, int nbits);
+
 int bincode_bit_pop(bincode_t* code);
 
+int bincode_bits_pop(bincode_t* code, size_t nbits);
+
+int bincode_get_bit(const bincode_t* code, size_t index);
+
 void bincode_free(bincode_t* code);
 
 int bincode_get_string(bincode_t* code, char* buf, size_t bufsize);
 
-static uint8_t bit_and_masks[8] =
+static const uint8_t bit_and_masks[8] =
 {
     0x7f, 0xbf, 0xdf, 0xef, 0xf7, 0xfb, 0xfd, 0xfe
 };
 
-static uint8_t bit_or_masks[8] =
+static const uint8_t bit_or_masks[8] =
 {
     0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01
 };
@@ -66,10 +80,79 @@ int bitstream_get_bit(bitstream_t* bs);
 
 int bitstream_set_bit(bitstream_t* bs, int bit);
 
+int bitstream_write_bits(bitstream_t* bs, uint64_t value, int nbits);
+
 int bitstream_write_bincode(bitstream_t* bs, bincode_t* code);
 
 int bitstream_eof(bitstream_t* bs);
 
-void bitstream_close(bitstream_t* fd);
+/* Flushes a partial last byte of a write stream, -1 when that fails. */
+int bitstream_close(bitstream_t* fd);
+
+/*
+ * In-memory bit I/O for the block codecs. Both sides are MSB-first like
+ * bitstream_t. The writer keeps pending bits in the low end of acc, the
+ * reader keeps look-ahead bits left-aligned in acc so the next n bits are
+ * simply acc >> (64 - n).
+ */
+struct bitwriter_s
+{
+    uint8_t* data;
+    size_t size;
+    size_t pos;
+    uint64_t acc;
+    int count;
+    int overflow;
+};
+
+typedef struct bitwriter_s bitwriter_t;
+
+void bitwriter_init(bitwriter_t* bw, uint8_t* data, size_t size);
+
+void bitwriter_spill(bitwriter_t* bw);
+
+int bitwriter_flush(bitwriter_t* bw);
+
+/* code must fit in len bits and len must be at most 32. */
+#define BITWRITER_PUT(bw, code, len)                                    \
+    do {                                                                \
+        (bw)->acc = ((bw)->acc << (len)) | (uint64_t) (code);           \
+        (bw)->count += (len);                                           \
+        if ((bw)->count >= 32)                                          \
+            bitwriter_spill(bw);                                        \
+    } while (0)
+
+struct bitreader_s
+{
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+    uint64_t acc;
+    int count;
+};
+
+typedef struct bitreader_s bitreader_t;
+
+void bitreader_init(
+    bitreader_t* br,
+    const uint8_t* data,
+    size_t size,
+    size_t bit_offset
+);
+
+void bitreader_refill(bitreader_t* br);
+
+size_t bitreader_tell(const bitreader_t* br);
+
+int bitreader_overrun(const bitreader_t* br);
+
+/* n must be between 1 and the number of bits held in acc. */
+#define BITREADER_PEEK(br, n)     ((uint32_t) ((br)->acc >> (64 - (n))))
+
+#define BITREADER_CONSUME(br, n)                                        \
+    do {                                                                \
+        (br)->acc <<= (n);                                              \
+        (br)->count -= (n);                                             \
+    } while (0)
 
 #endif
@@ -0,0 +1,176 @@
+#include "cache.h"
+
+#include <string.h>
+
+huffman_table_cache_t* huffman_table_cache_create(size_t slots, size_t symbols)
+{
+    huffman_table_cache_t* cache = NULL;
+    size_t i = 0;
+    
+    if (0 == slots || slots > HUFFMAN_TABLE_CACHE_MAX_SLOTS || 0 == symbols)
+        return NULL;
+    
+    cache = (huffman_table_cache_t*) malloc(sizeof(huffman_table_cache_t));
+    if (NULL == cache)
+        return NULL;
+    
+    cache->size = slots;
+    cache->clock = 0;
+    cache->entries = (huffman_table_cache_entry_t*)
+        malloc(slots * sizeof(huffman_table_cache_entry_t));
+    if (NULL == cache->entries)
+    {
+        free(cache);
+        return NULL;
+    }
+    
+    for (i = 0; i < slots; i++)
+    {
+        huffman_table_cache_entry_t* e = &cache->entries[i];
+        
+        e->valid = 0;
+        e->key = 0;
+        e->used = 0;
+        e->ct = huffman_codetab_create(symbols);
+        if (NULL == e->ct)
+        {
+            cache->size = i;
+            huffman_table_cache_free(cache);
+            return NULL;
+        }
+    }
+    
+    return cache;
+}
+
+void huffman_table_cache_free(huffman_table_cache_t* cache)
+{
+    size_t i = 0;
+    
+    if (NULL == cache)
+        return;
+    
+    if (NULL != cache->entries)
+    {
+        for (i = 0; i < cache->size; i++)
+            huffman_codetab_free(cache->entries[i].ct);
+        
+        free(cache->entries);
+    }
+    
+    free(cache);
+    return;
+}
+
+uint64_t huffman_table_cache_key(const chartab_t* tab)
+{
+    /* FNV-1a over one bucket per symbol. */
+    uint64_t hash = (uint64_t) 0xcbf29ce4 << 32 | 0x84222325;
+    size_t total = chartab_total(tab);
+    size_t i = 0;
+    
+    if (0 == total)
+        return hash;
+    
+    for (i = 0; i < tab->size; i++)
+    {
+        /* Bucket is the bit length of the probability in 1/65536. */
+        double scaled = (double) tab->items[i].count * 65536.0 / (double) total;
+        uint32_t q = (uint32_t) scaled;
+        int bucket = tab->items[i].count > 0 ? 1 : 0;
+        
+        while (q > 0)
+        {
+            bucket += 1;
+            q >>= 1;
+        }
+        
+        hash ^= (uint64_t) bucket;
+        hash *= (uint64_t) 0x100 << 32 | 0x1b3;
+    }
+    
+    return hash;
+}
+
+int huffman_table_cache_find(huffman_table_cache_t* cache, uint64_t key)
+{
+    size_t i = 0;
+    
+    if (NULL == cache)
+        return -1;
+    
+    for (i = 0; i < cache->size; i++)
+    {
+        if (cache->entries[i].valid && key == cache->entries[i].key)
+            return (int) i;
+    }
+    
+    return -1;
+}
+
+int huffman_table_cache_insert(
+    huffman_table_cache_t* cache,
+    uint64_t key,
+    const huffman_codetab_t* ct
+)
+{
+    huffman_table_cache_entry_t* e = NULL;
+    size_t i = 0, victim = 0;
+    int found = 0;
+    
+    if (NULL == cache || NULL == ct || ct->size != cache->entries[0].ct->size)
+        return -1;
+    
+    /*
+     * A table for a key already cached replaces that entry, the caller
+     * found it too costly. Keeping both would leave find() returning the
+     * old one and waste a slot.
+     */
+    found = huffman_table_cache_find(cache, key);
+    if (found >= 0)
+        victim = (size_t) found;
+    
+    for (i = 0; found < 0 && i < cache->size; i++)
+    {
+        if (!cache->entries[i].valid)
+        {
+            victim = i;
+            break;
+        }
+        
+        if (cache->entries[i].used < cache->entries[victim].used)
+            victim = i;
+    }
+    
+    e = &cache->entries[victim];
+    memcpy(e->ct->lengths, ct->lengths, ct->size * sizeof(uint8_t));
+    memcpy(e->ct->codes, ct->codes, ct->size * sizeof(uint32_t));
+    e->ct->max_length = ct->max_length;
+    e->key = key;
+    e->valid = 1;
+    huffman_table_cache_touch(cache, (int) victim);
+    return (int) victim;
+}
+
+void huffman_table_cache_touch(huffman_table_cache_t* cache, int slot)
+{
+    if (NULL == cache || slot < 0 || (size_t) slot >= cache->size)
+        return;
+    
+    cache->clock += 1;
+    cache->entries[slot].used = cache->clock;
+}
+
+huffman_codetab_t* huffman_table_cache_get(
+    huffman_table_cache_t* cache,
+    int slot
+)
+{
+    if (NULL == cache || slot < 0 || (size_t) slot >= cache->size)
+        return NULL;
+    
+    if (!cache->entries[slot].valid)
+        return NULL;
+    
+    return cache->entries[slot].ct;
+}
@@ -0,0 +1,58 @@
+#ifndef ___huffman__cache_h___
+#define ___huffman__cache_h___
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "huffman.h"
+
+/* Slot numbers travel in a nibble of the block header. */
+#define HUFFMAN_TABLE_CACHE_MAX_SLOTS   16
+
+/*
+ * Recently built code tables, least recently used evicted first. Entries
+ * are keyed by a hash of the histogram quantized to log2 buckets, so
+ * blocks with nearly the same distribution land on the same table.
+ */
+struct huffman_table_cache_entry_s
+{
+    int valid;
+    uint64_t key;
+    unsigned long used;
+    huffman_codetab_t* ct;
+};
+
+typedef struct huffman_table_cache_entry_s huffman_table_cache_entry_t;
+
+struct huffman_table_cache_s
+{
+    size_t size;
+    unsigned long clock;
+    huffman_table_cache_entry_t* entries;
+};
+
+typedef struct huffman_table_cache_s huffman_table_cache_t;
+
+/* Entries hold tables over an alphabet of symbols. */
+huffman_table_cache_t* huffman_table_cache_create(size_t slots, size_t symbols);
+
+void huffman_table_cache_free(huffman_table_cache_t* cache);
+
+uint64_t huffman_table_cache_key(const chartab_t* tab);
+
+int huffman_table_cache_find(huffman_table_cache_t* cache, uint64_t key);
+
+int huffman_table_cache_insert(
+    huffman_table_cache_t* cache,
+    uint64_t key,
+    const huffman_codetab_t* ct
+);
+
+void huffman_table_cache_touch(huffman_table_cache_t* cache, int slot);
+
+huffman_codetab_t* huffman_table_cache_get(
+    huffman_table_cache_t* cache,
+    int slot
+);
+
+#endif
@@ -0,0 +1,141 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "client.h"
+#include "codec.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+int huffman_socket_read_full(int fd, void* buf, size_t size)
+{
+    uint8_t* p = (uint8_t*) buf;
+    
+    while (size > 0)
+    {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && EINTR == errno)
+            continue;
+        
+        if (n <= 0)
+            return -1;
+        
+        p += n;
+        size -= (size_t) n;
+    }
+    
+    return 0;
+}
+
+int huffman_socket_write_full(int fd, const void* buf, size_t size)
+{
+    const uint8_t* p = (const uint8_t*) buf;
+    
+    while (size > 0)
+    {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && EINTR == errno)
+            continue;
+        
+        if (n <= 0)
+            return -1;
+        
+        p += n;
+        size -= (size_t) n;
+    }
+    
+    return 0;
+}
+
+int huffman_client_connect(const char* socket_path)
+{
+    struct sockaddr_un addr;
+    int fd = -1;
+    
+    if (NULL == socket_path || strlen(socket_path) >= sizeof(addr.sun_path))
+        return -1;
+    
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -2;
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if (0 != connect(fd, (struct sockaddr*) &addr, sizeof(addr)))
+    {
+        close(fd);
+        return -3;
+    }
+    
+    return fd;
+}
+
+int huffman_client_request(
+    int fd,
+    int op,
+    const uint8_t* in,
+    size_t in_size,
+    uint8_t** out,
+    size_t* out_size
+)
+{
+    uint8_t header[HUFFMAN_SERVER_REQUEST_SIZE];
+    uint8_t reply[HUFFMAN_SERVER_RESPONSE_SIZE];
+    uint8_t* payload = NULL;
+    size_t length = 0;
+    int status = 0;
+    
+    if (fd < 0 || NULL == out || NULL == out_size ||
+        (NULL == in && in_size > 0))
+        return -1;
+    
+    if (in_size > HUFFMAN_SERVER_MAX_PAYLOAD)
+        return -1;
+    
+    memcpy(header, HUFFMAN_SERVER_MAGIC, 4);
+    header[4] = (uint8_t) op;
+    header[5] = header[6] = header[7] = 0;
+    huffman_put_le(header + 8, in_size, 4);
+    
+    if (0 != huffman_socket_write_full(fd, header, sizeof(header)) ||
+        0 != huffman_socket_write_full(fd, in, in_size))
+        return -11;
+    
+    if (0 != huffman_socket_read_full(fd, reply, sizeof(reply)))
+        return -11;
+    
+    status = (int) (int32_t) huffman_get_le(reply, 4);
+    length = (size_t) huffman_get_le(reply + 4, 4);
+    if (length > HUFFMAN_SERVER_MAX_PAYLOAD)
+        return -11;
+    
+    payload = (uint8_t*) malloc(length > 0 ? length : 1);
+    if (NULL == payload)
+        return -7;
+    
+    if (0 != huffman_socket_read_full(fd, payload, length))
+    {
+        free(payload);
+        return -11;
+    }
+    
+    if (0 != status)
+    {
+        free(payload);
+        return status;
+    }
+    
+    *out = payload;
+    *out_size = length;
+    return 0;
+}
+
+void huffman_client_close(int fd)
+{
+    if (fd >= 0)
+        close(fd);
+}
@@ -0,0 +1,27 @@
+#ifndef ___huffman__client_h___
+#define ___huffman__client_h___
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "server.h"
+
+int huffman_client_connect(const char* socket_path);
+
+/* On success *out is malloc()ed and owned by the caller. */
+int huffman_client_request(
+    int fd,
+    int op,
+    const uint8_t* in,
+    size_t in_size,
+    uint8_t** out,
+    size_t* out_size
+);
+
+void huffman_client_close(int fd);
+
+int huffman_socket_read_full(int fd, void* buf, size_t size);
+
+int huffman_socket_write_full(int fd, const void* buf, size_t size);
+
+#endif
@@ -0,0 +1,1569 @@
+#include "codec.h"
+#include "cache.h"
+#include "dispatch.h"
+#include "parallel.h"
+#include "compact.h"
+#include "rle.h"
+
+#include <string.h>
+
+#define HUFFMAN_IO_CHUNK_SIZE (1024 * 1024)
+
+void huffman_put_le(uint8_t* p, uint64_t value, int nbytes)
+{
+    int i = 0;
+    for (i = 0; i < nbytes; i++)
+        p[i] = (uint8_t) (value >> (8 * i));
+}
+
+uint64_t huffman_get_le(const uint8_t* p, int nbytes)
+{
+    uint64_t value = 0;
+    int i = 0;
+    
+    for (i = nbytes - 1; i >= 0; i--)
+        value = (value << 8) | p[i];
+    
+    return value;
+}
+
+/*
+ * Pick a table already known to the decoder when coding tab with it is
+ * no dearer than the entropy bound plus the bytes of a fresh table.
+ * Candidates are the entry with the same quantized histogram and the
+ * table of the previous block. Returns the slot, -1 to build anew.
+ */
+static int choose_cached_table(
+    huffman_table_cache_t* cache,
+    uint64_t key,
+    int current,
+    const chartab_t* tab
+)
+{
+    double best_cost = chartab_entropy_bits(tab) +
+        8.0 * HUFFMAN_TABLE_BYTES(tab->size);
+    int candidates[2];
+    int best = -1, i = 0;
+    
+    candidates[0] = huffman_table_cache_find(cache, key);
+    candidates[1] = current;
+    for (i = 0; i < 2; i++)
+    {
+        size_t cost = 0;
+        
+        if (candidates[i] < 0)
+            continue;
+        
+        cost = huffman_codetab_cost(
+            huffman_table_cache_get(cache, candidates[i]), tab);
+        if ((size_t) -1 != cost && (double) cost <= best_cost)
+        {
+            best = candidates[i];
+            best_cost = (double) cost;
+        }
+    }
+    
+    return best;
+}
+
+void huffman_options_init(huffman_options_t* opt)
+{
+    if (NULL == opt)
+        return;
+    
+    opt->mode = HUFFMAN_MODE_BLOCK;
+    opt->block_size = HUFFMAN_DEFAULT_BLOCK_SIZE;
+    opt->reuse_drift = -1;
+    opt->table_cache = HUFFMAN_TABLE_CACHE_DEFAULT_SLOTS;
+    opt->threads = 1;
+    opt->io = HUFFMAN_IO_STDIO;
+    opt->io_depth = HUFFMAN_IO_DEFAULT_DEPTH;
+    opt->compact = 0;
+    opt->checksum = 0;
+    opt->rle = 0;
+    opt->record.fields = 0;
+    opt->record.size = 0;
+}
+
+size_t huffman_encode_bound(size_t raw_size)
+{
+    return raw_size / 8 * HUFFMAN_MAX_CODE_LENGTH +
+        HUFFMAN_MAX_CODE_LENGTH + 16;
+}
+
+size_t huffman_table_write(const huffman_codetab_t* ct, uint8_t* buf)
+{
+    size_t i = 0;
+    
+    memset(buf, 0, HUFFMAN_TABLE_BYTES(ct->size));
+    for (i = 0; i < ct->size; i++)
+    {
+        uint8_t len = (uint8_t) (ct->lengths[i] & 0x0f);
+        buf[i / 2] |= (i % 2) ? len : (uint8_t) (len << 4);
+    }
+    
+    return HUFFMAN_TABLE_BYTES(ct->size);
+}
+
+int huffman_table_read(huffman_codetab_t* ct, const uint8_t* buf)
+{
+    size_t i = 0;
+    
+    if (NULL == ct || NULL == buf)
+        return -1;
+    
+    for (i = 0; i < ct->size; i++)
+        ct->lengths[i] = (i % 2) ? (buf[i / 2] & 0x0f) : (buf[i / 2] >> 4);
+    
+    if (0 != huffman_codetab_assign_codes(ct))
+        return -2;
+    
+    return 0;
+}
+
+int huffman_encode_symbols(
+    const huffman_codetab_t* ct,
+    const uint8_t* in,
+    size_t in_size,
+    bitwriter_t* bw
+)
+{
+    const uint8_t* lengths = NULL;
+    const uint32_t* codes = NULL;
+    size_t i = 0;
+    
+    if (NULL == ct || NULL == bw || (NULL == in && in_size > 0))
+        return -1;
+    
+    lengths = ct->lengths;
+    codes = ct->codes;
+    for (i = 0; i < in_size; i++)
+    {
+        int len = lengths[in[i]];
+        if (0 == len)
+            return -2;
+        
+        BITWRITER_PUT(bw, codes[in[i]], len);
+    }
+    
+    bitwriter_spill(bw);
+    return bw->overflow ? -3 : 0;
+}
+
+huffman_decoder_t* huffman_decoder_create(void)
+{
+    huffman_decoder_t* dec = (huffman_decoder_t*)
+        malloc(sizeof(huffman_decoder_t));
+    
+    if (NULL == dec)
+        return NULL;
+    
+    dec->bits = 0;
+    dec->table = (uint16_t*)
+        malloc(sizeof(uint16_t) << HUFFMAN_MAX_CODE_LENGTH);
+    if (NULL == dec->table)
+    {
+        free(dec);
+        return NULL;
+    }
+    
+    return dec;
+}
+
+void huffman_decoder_free(huffman_decoder_t* dec)
+{
+    if (NULL == dec)
+        return;
+    
+    if (NULL != dec->table)
+        free(dec->table);
+    
+    free(dec);
+    return;
+}
+
+int huffman_decoder_build(huffman_decoder_t* dec, const huffman_codetab_t* ct)
+{
+    size_t i = 0;
+    int bits = 0;
+    
+    if (NULL == dec || NULL == ct)
+        return -1;
+    
+    /* Entries are (symbol << 4 | length), a zero length marks a hole. */
+    bits = ct->max_length > 0 ? ct->max_length : 1;
+    if (bits > HUFFMAN_MAX_CODE_LENGTH || ct->size > 4096)
+        return -2;
+    
+    dec->bits = bits;
+    memset(dec->table, 0, sizeof(uint16_t) << bits);
+    for (i = 0; i < ct->size; i++)
+    {
+        int len = ct->lengths[i];
+        uint32_t first = 0, n = 0, k = 0;
+        
+        if (0 == len)
+            continue;
+        
+        first = ct->codes[i] << (bits - len);
+        n = (uint32_t) 1 << (bits - len);
+        for (k = 0; k < n; k++)
+            dec->table[first + k] = (uint16_t) ((i << 4) | (size_t) len);
+    }
+    
+    return 0;
+}
+
+int huffman_decode_symbols(
+    const huffman_decoder_t* dec,
+    bitreader_t* br,
+    uint8_t* out,
+    size_t count
+)
+{
+    if (NULL == dec || NULL == br || (NULL == out && count > 0))
+        return -1;
+    
+    return huffman_kernels()->decode(dec->table, dec->bits, br, out, count);
+}
+
+static int write_file_header(huffman_io_t* out, int mode, int flags)
+{
+    uint8_t header[HUFFMAN_FILE_HEADER_SIZE];
+    
+    memcpy(header, HUFFMAN_MAGIC, 4);
+    header[4] = HUFFMAN_FORMAT_VERSION;
+    header[5] = (uint8_t) mode;
+    header[6] = (uint8_t) flags;
+    header[7] = 0;
+    
+    if (HUFFMAN_FILE_HEADER_SIZE !=
+        huffman_io_write(out, header, HUFFMAN_FILE_HEADER_SIZE))
+        return -1;
+    
+    return 0;
+}
+
+/*
+ * Whole-file table: one pass to count, a second pass to code. The input
+ * has to be seekable.
+ */
+static int encode_file_stream(
+    huffman_io_t* in,
+    huffman_io_t* out,
+    uint8_t* inbuf,
+    uint8_t* outbuf,
+    size_t chunk_size,
+    int flags,
+    chartab_t* tab,
+    huffman_codetab_t* ct
+)
+{
+    uint8_t header[8 + HUFFMAN_CHECKSUM_SIZE +
+        HUFFMAN_TABLE_BYTES(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE)];
+    bitwriter_t bw;
+    uint64_t raw_size = 0;
+    uint32_t crc = 0;
+    size_t n = 0, header_size = 8;
+    
+    /* The checksum rides along with the counting pass. */
+    while (0 < (n = huffman_io_read(in, inbuf, chunk_size)))
+    {
+        chartab_accumulate(tab, inbuf, n);
+        if (flags & HUFFMAN_FLAG_CHECKSUM)
+            crc = huffman_crc32c(crc, inbuf, n);
+        
+        raw_size += n;
+    }
+    
+    if (huffman_io_error(in))
+        return -2;
+    
+    if (0 != huffman_io_rewind(in))
+        return -3;
+    
+    if (0 != huffman_codetab_build(ct, tab, HUFFMAN_MAX_CODE_LENGTH))
+        return -4;
+    
+    huffman_put_le(header, raw_size, 8);
+    if (flags & HUFFMAN_FLAG_CHECKSUM)
+    {
+        huffman_put_le(header + 8, crc, 4);
+        header_size += 4;
+    }
+    
+    header_size += huffman_table_write(ct, header + header_size);
+    if (0 != write_file_header(out, HUFFMAN_MODE_STREAM, flags) ||
+        header_size != huffman_io_write(out, header, header_size))
+        return -5;
+    
+    bitwriter_init(&bw, outbuf, huffman_encode_bound(chunk_size));
+    while (0 < (n = huffman_io_read(in, inbuf, chunk_size)))
+    {
+        if (0 != huffman_encode_symbols(ct, inbuf, n, &bw))
+            return -6;
+        
+        if (bw.pos != huffman_io_write(out, outbuf, bw.pos))
+            return -5;
+        
+        bw.pos = 0;
+    }
+    
+    if (huffman_io_error(in))
+        return -2;
+    
+    if (0 != bitwriter_flush(&bw) ||
+        bw.pos != huffman_io_write(out, outbuf, bw.pos))
+        return -5;
+    
+    return 0;
+}
+
+/*
+ * Cache blocked: each block is counted, given its own table and coded
+ * while it is still resident, so the input is only read once. With a
+ * table cache, tables go into numbered slots the decoder mirrors, and a
+ * block may point at a slot instead of carrying a table. With rle set,
+ * tab, ref, ct and the cache are over the run length alphabet.
+ *
+ * With a window, the drift check looks at the last few blocks rather
+ * than the current one alone, and ref holds the window as it was when
+ * the table was picked, so one odd block does not force a new table.
+ */
+static int encode_file_block(
+    huffman_io_t* in,
+    huffman_io_t* out,
+    uint8_t* inbuf,
+    uint8_t* outbuf,
+    size_t block_size,
+    int reuse_drift,
+    size_t rle,
+    int flags,
+    chartab_t* tab,
+    chartab_t* ref,
+    chartab_window_t* win,
+    huffman_codetab_t* ct,
+    huffman_table_cache_t* cache
+)
+{
+    uint8_t header[HUFFMAN_BLOCK_HEADER_SIZE + HUFFMAN_CHECKSUM_SIZE +
+        HUFFMAN_TABLE_BYTES(HUFFMAN_RLE_ALPHABET_SIZE)];
+    const huffman_codetab_t* cur = NULL;
+    const chartab_t* recent = NULL != win ? win->tab : tab;
+    bitwriter_t bw;
+    uint64_t key = 0;
+    uint32_t crc = 0, file_crc = 0;
+    size_t n = 0, header_size = 0;
+    int kind = 0, slot = 0;
+    
+    if (0 != write_file_header(out, HUFFMAN_MODE_BLOCK, flags))
+        return -5;
+    
+    while (0 < (n = huffman_io_read(in, inbuf, block_size)))
+    {
+        chartab_clear(tab);
+        if (rle > 0)
+            huffman_rle_count(tab, inbuf, n, rle);
+        else
+            chartab_accumulate(tab, inbuf, n);
+        
+        if (NULL != win && 0 != chartab_window_push(win, tab))
+            return -4;
+        
+        /* Checked while the block is still resident from counting. */
+        if (flags & HUFFMAN_FLAG_CHECKSUM)
+        {
+            crc = huffman_crc32c(0, inbuf, n);
+            file_crc = huffman_crc32c_combine(file_crc, crc, n);
+        }
+        
+        /* Keep the previous table while the statistics barely moved. */
+        kind = HUFFMAN_BLOCK_TABLE_INLINE;
+        if (NULL != cur && reuse_drift >= 0 &&
+            (size_t) -1 != huffman_codetab_cost(cur, tab) &&
+            chartab_drift(recent, ref) <= reuse_drift)
+            kind = HUFFMAN_BLOCK_TABLE_REPEAT;
+        
+        else if (NULL != cache)
+        {
+            key = huffman_table_cache_key(tab);
+            slot = choose_cached_table(cache, key, NULL != cur ? slot : -1,
+                                       tab);
+            if (slot >= 0)
+            {
+                kind = HUFFMAN_BLOCK_TABLE_CACHED;
+                cur = huffman_table_cache_get(cache, slot);
+                huffman_table_cache_touch(cache, slot);
+                chartab_clear(ref);
+                chartab_merge(ref, recent);
+            }
+        }
+        
+        if (HUFFMAN_BLOCK_TABLE_INLINE == kind)
+        {
+            if (0 != huffman_codetab_build(ct, tab, HUFFMAN_MAX_CODE_LENGTH))
+                return -4;
+            
+            chartab_clear(ref);
+            chartab_merge(ref, recent);
+            cur = ct;
+            slot = 0;
+            if (NULL != cache)
+            {
+                slot = huffman_table_cache_insert(cache, key, ct);
+                cur = huffman_table_cache_get(cache, slot);
+            }
+        }
+        
+        bitwriter_init(&bw, outbuf, huffman_encode_bound(block_size));
+        if (0 != (rle > 0 ? huffman_rle_encode(cur, inbuf, n, rle, &bw) :
+                            huffman_encode_symbols(cur, inbuf, n, &bw)) ||
+            0 != bitwriter_flush(&bw))
+            return -6;
+        
+        huffman_put_le(header, n, 4);
+        huffman_put_le(header + 4, bw.pos, 4);
+        header[8] = (uint8_t) (kind | slot << 4);
+        header_size = HUFFMAN_BLOCK_HEADER_SIZE;
+        if (flags & HUFFMAN_FLAG_CHECKSUM)
+        {
+            huffman_put_le(header + header_size, crc, 4);
+            header_size += HUFFMAN_CHECKSUM_SIZE;
+        }
+        
+        if (HUFFMAN_BLOCK_TABLE_INLINE == kind)
+            header_size += huffman_table_write(cur, header + header_size);
+        
+        if (header_size != huffman_io_write(out, header, header_size) ||
+            bw.pos != huffman_io_write(out, outbuf, bw.pos))
+            return -5;
+    }
+    
+    if (huffman_io_error(in))
+        return -2;
+    
+    memset(header, 0, HUFFMAN_BLOCK_HEADER_SIZE);
+    header_size = HUFFMAN_BLOCK_HEADER_SIZE;
+    if (flags & HUFFMAN_FLAG_CHECKSUM)
+    {
+        huffman_put_le(header + header_size, file_crc, 4);
+        header_size += HUFFMAN_CHECKSUM_SIZE;
+    }
+    
+    if (header_size != huffman_io_write(out, header, header_size))
+        return -5;
+    
+    return 0;
+}
+
+/*
+ * Record mode: like block mode, but each block is split into the columns
+ * of its fields and every column is counted, given a table and coded on
+ * its own. block_size is a whole number of records.
+ */
+static int encode_file_record(
+    huffman_io_t* in,
+    huffman_io_t* out,
+    uint8_t* inbuf,
+    uint8_t* outbuf,
+    uint8_t* column,
+    size_t block_size,
+    const huffman_record_layout_t* layout,
+    int flags,
+    chartab_t* tab,
+    huffman_codetab_t* ct
+)
+{
+    uint8_t header[4 + HUFFMAN_CHECKSUM_SIZE +
+        HUFFMAN_TABLE_BYTES(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE)];
+    uint8_t fields[1 + 2 * HUFFMAN_RECORD_MAX_FIELDS];
+    bitwriter_t bw;
+    uint32_t crc = 0, file_crc = 0;
+    size_t n = 0, m = 0, header_size = 0;
+    int i = 0;
+    
+    fields[0] = (uint8_t) layout->fields;
+    for (i = 0; i < layout->fields; i++)
+        huffman_put_le(fields + 1 + 2 * i, layout->widths[i], 2);
+    
+    if (0 != write_file_header(out, HUFFMAN_MODE_RECORD, flags) ||
+        (size_t) (1 + 2 * layout->fields) !=
+            huffman_io_write(out, fields, 1 + 2 * layout->fields))
+        return -5;
+    
+    while (0 < (n = huffman_io_read(in, inbuf, block_size)))
+    {
+        huffman_put_le(header, n, 4);
+        header_size = 4;
+        if (flags & HUFFMAN_FLAG_CHECKSUM)
+        {
+            crc = huffman_crc32c(0, inbuf, n);
+            file_crc = huffman_crc32c_combine(file_crc, crc, n);
+            huffman_put_le(header + header_size, crc, 4);
+            header_size += HUFFMAN_CHECKSUM_SIZE;
+        }
+        
+        if (header_size != huffman_io_write(out, header, header_size))
+            return -5;
+        
+        for (i = 0; i < layout->fields; i++)
+        {
+            m = huffman_record_gather(layout, i, inbuf, n, column);
+            chartab_clear(tab);
+            chartab_accumulate(tab, column, m);
+            if (0 != huffman_codetab_build(ct, tab, HUFFMAN_MAX_CODE_LENGTH))
+                return -4;
+            
+            bitwriter_init(&bw, outbuf, huffman_encode_bound(block_size));
+            if (0 != huffman_encode_symbols(ct, column, m, &bw) ||
+                0 != bitwriter_flush(&bw))
+                return -6;
+            
+            huffman_put_le(header, bw.pos, 4);
+            header_size = 4 + huffman_table_write(ct, header + 4);
+            if (header_size != huffman_io_write(out, header, header_size) ||
+                bw.pos != huffman_io_write(out, outbuf, bw.pos))
+                return -5;
+        }
+    }
+    
+    if (huffman_io_error(in))
+        return -2;
+    
+    memset(header, 0, 4);
+    header_size = 4;
+    if (flags & HUFFMAN_FLAG_CHECKSUM)
+    {
+        huffman_put_le(header + header_size, file_crc, 4);
+        header_size += HUFFMAN_CHECKSUM_SIZE;
+    }
+    
+    if (header_size != huffman_io_write(out, header, header_size))
+        return -5;
+    
+    return 0;
+}
+
+int huffman_encode_file(FILE* in, FILE* out, const huffman_options_t* opt)
+{
+    huffman_options_t defaults;
+    huffman_io_t* src = NULL;
+    huffman_io_t* dst = NULL;
+    chartab_t* tab = NULL;
+    chartab_t* ref = NULL;
+    chartab_window_t* win = NULL;
+    huffman_codetab_t* ct = NULL;
+    huffman_table_cache_t* cache = NULL;
+    uint8_t* inbuf = NULL;
+    uint8_t* outbuf = NULL;
+    uint8_t* column = NULL;
+    size_t block_size = 0, symbols = HUFFMAN_ASCII_BYTE_CHARTAB_SIZE;
+    int flags = 0, ret = 0;
+    
+    if (NULL == in || NULL == out)
+        return -1;
+    
+    if (NULL == opt)
+    {
+        huffman_options_init(&defaults);
+        opt = &defaults;
+    }
+    
+    if (opt->checksum)
+        flags |= HUFFMAN_FLAG_CHECKSUM;
+    
+    if (opt->rle > 0)
+    {
+        if (HUFFMAN_MODE_BLOCK != opt->mode ||
+            opt->rle < HUFFMAN_RLE_MIN_THRESHOLD)
+            return -1;
+        
+        flags |= HUFFMAN_FLAG_RLE;
+        symbols = HUFFMAN_RLE_ALPHABET_SIZE;
+    }
+    
+    block_size = opt->block_size;
+    if (HUFFMAN_MODE_STREAM == opt->mode)
+        block_size = HUFFMAN_IO_CHUNK_SIZE;
+    
+    /* Blocks end on a record boundary, so fields line up in every block. */
+    if (HUFFMAN_MODE_RECORD == opt->mode)
+    {
+        if (opt->record.fields < 1 || 0 == opt->record.size)
+            return -1;
+        
+        block_size -= block_size % opt->record.size;
+        if (0 == block_size)
+            block_size = opt->record.size;
+    }
+    
+    if (0 == block_size || block_size > HUFFMAN_MAX_BLOCK_SIZE ||
+        opt->table_cache > HUFFMAN_TABLE_CACHE_MAX_SLOTS)
+        return -1;
+    
+    tab = chartab_create(symbols);
+    ref = chartab_create(symbols);
+    ct = huffman_codetab_create(symbols);
+    inbuf = (uint8_t*) malloc(block_size);
+    outbuf = (uint8_t*) malloc(huffman_encode_bound(block_size));
+    
+    src = huffman_io_open(in, 0, opt->io, opt->io_depth);
+    dst = huffman_io_open(out, 1, opt->io, opt->io_depth);
+    
+    if (HUFFMAN_MODE_BLOCK == opt->mode && opt->table_cache > 0)
+        cache = huffman_table_cache_create(opt->table_cache, symbols);
+    
+    if (HUFFMAN_MODE_RECORD == opt->mode)
+        column = (uint8_t*) malloc(block_size);
+    
+    if (HUFFMAN_MODE_BLOCK == opt->mode && opt->reuse_drift >= 0)
+        win = chartab_window_create(HUFFMAN_DRIFT_WINDOW_BLOCKS, symbols);
+    
+    if (NULL == tab || NULL == ref || NULL == ct ||
+        NULL == inbuf || NULL == outbuf || NULL == src || NULL == dst ||
+        (NULL == cache && HUFFMAN_MODE_BLOCK == opt->mode &&
+         opt->table_cache > 0) ||
+        (HUFFMAN_MODE_RECORD == opt->mode && NULL == column) ||
+        (NULL == win && HUFFMAN_MODE_BLOCK == opt->mode &&
+         opt->reuse_drift >= 0))
+        ret = -7;
+    else if (HUFFMAN_MODE_STREAM == opt->mode)
+        ret = encode_file_stream(src, dst, inbuf, outbuf, block_size,
+                                 flags, tab, ct);
+    else if (HUFFMAN_MODE_RECORD == opt->mode)
+        ret = encode_file_record(src, dst, inbuf, outbuf, column, block_size,
+                                 &opt->record, flags, tab, ct);
+    else
+        ret = encode_file_block(src, dst, inbuf, outbuf, block_size,
+                                opt->reuse_drift, opt->rle, flags,
+                                tab, ref, win, ct, cache);
+    
+    if (NULL != src && 0 != huffman_io_close(src) && 0 == ret)
+        ret = -2;
+    
+    if (NULL != dst && 0 != huffman_io_close(dst) && 0 == ret)
+        ret = -5;
+    
+    free(inbuf);
+    free(outbuf);
+    free(column);
+    huffman_table_cache_free(cache);
+    huffman_codetab_free(ct);
+    chartab_window_free(win);
+    chartab_free(ref);
+    chartab_free(tab);
+    return ret;
+}
+
+/* File decoding runs either decoder, the compact one when cdec is set. */
+static int build_decoder(
+    huffman_decoder_t* dec,
+    huffman_compact_decoder_t* cdec,
+    const huffman_codetab_t* ct
+)
+{
+    if (NULL != cdec)
+        return huffman_compact_decoder_build(cdec, ct);
+    
+    return huffman_decoder_build(dec, ct);
+}
+
+static int run_decoder(
+    const huffman_decoder_t* dec,
+    const huffman_compact_decoder_t* cdec,
+    bitreader_t* br,
+    uint8_t* out,
+    size_t count
+)
+{
+    if (NULL != cdec)
+        return huffman_compact_decode_symbols(cdec, br, out, count);
+    
+    return huffman_decode_symbols(dec, br, out, count);
+}
+
+/* Load the rest of the stream and decode it with several threads. */
+static int decode_file_stream_parallel(
+    huffman_io_t* in,
+    huffman_io_t* out,
+    uint64_t raw_size,
+    const uint8_t* checksum,
+    huffman_decoder_t* dec,
+    int threads
+)
+{
+    uint8_t* data = NULL;
+    uint8_t* outbuf = NULL;
+    size_t size = 0, cap = 0, n = 0;
+    int ret = 0;
+    
+    if (raw_size != (uint64_t) (size_t) raw_size)
+        return -7;
+    
+    do
+    {
+        if (size == cap)
+        {
+            uint8_t* p = (uint8_t*) realloc(data, cap + HUFFMAN_IO_CHUNK_SIZE);
+            if (NULL == p)
+            {
+                free(data);
+                return -7;
+            }
+            
+            data = p;
+            cap += HUFFMAN_IO_CHUNK_SIZE;
+        }
+        
+        n = huffman_io_read(in, data + size, cap - size);
+        size += n;
+    } while (n > 0);
+    
+    if (huffman_io_error(in))
+        ret = -2;
+    
+    outbuf = (uint8_t*) malloc(raw_size > 0 ? (size_t) raw_size : 1);
+    if (0 == ret && NULL == outbuf)
+        ret = -7;
+    
+    if (0 == ret)
+        ret = huffman_decode_parallel(dec, data, size, outbuf,
+                                      (size_t) raw_size, threads);
+    
+    if (0 == ret && NULL != checksum &&
+        huffman_get_le(checksum, 4) != huffman_crc32c(0, outbuf, (size_t) raw_size))
+        ret = -12;
+    
+    if (0 == ret &&
+        raw_size != huffman_io_write(out, outbuf, (size_t) raw_size))
+        ret = -5;
+    
+    free(data);
+    free(outbuf);
+    return ret;
+}
+
+static int decode_file_stream(
+    huffman_io_t* in,
+    huffman_io_t* out,
+    huffman_codetab_t* ct,
+    huffman_decoder_t* dec,
+    huffman_compact_decoder_t* cdec,
+    int flags,
+    int threads
+)
+{
+    uint8_t header[8 + HUFFMAN_CHECKSUM_SIZE +
+        HUFFMAN_TABLE_BYTES(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE)];
+    const uint8_t* checksum = NULL;
+    uint8_t* inbuf = NULL;
+    uint8_t* outbuf = NULL;
+    uint64_t remaining = 0;
+    uint32_t crc = 0;
+    size_t avail = 0, bit_offset = 0, header_size = 8;
+    int eof = 0, ret = 0, max_length = 0;
+    
+    if (flags & HUFFMAN_FLAG_CHECKSUM)
+    {
+        checksum = header + header_size;
+        header_size += HUFFMAN_CHECKSUM_SIZE;
+    }
+    
+    header_size += HUFFMAN_TABLE_BYTES(ct->size);
+    if (header_size != huffman_io_read(in, header, header_size))
+        return -8;
+    
+    remaining = huffman_get_le(header, 8);
+    if (0 != huffman_table_read(ct, header + header_size -
+                                    HUFFMAN_TABLE_BYTES(ct->size)) ||
+        0 != build_decoder(dec, cdec, ct))
+        return -9;
+    
+    max_length = ct->max_length > 0 ? ct->max_length : 1;
+    if (threads > 1 && remaining > 0 && NULL == cdec)
+        return decode_file_stream_parallel(in, out, remaining, checksum,
+                                           dec, threads);
+    
+    inbuf = (uint8_t*) malloc(HUFFMAN_IO_CHUNK_SIZE);
+    outbuf = (uint8_t*) malloc(HUFFMAN_IO_CHUNK_SIZE);
+    if (NULL == inbuf || NULL == outbuf)
+        ret = -7;
+    
+    while (0 == ret && remaining > 0)
+    {
+        bitreader_t br;
+        size_t want = 0, consumed = 0;
+        
+        if (!eof)
+        {
+            size_t n = huffman_io_read(in, inbuf + avail,
+                                       HUFFMAN_IO_CHUNK_SIZE - avail);
+            if (huffman_io_error(in))
+            {
+                ret = -2;
+                break;
+            }
+            
+            avail += n;
+            eof = huffman_io_eof(in);
+        }
+        
+        /* Without more input only symbols known to be complete are safe. */
+        want = HUFFMAN_IO_CHUNK_SIZE;
+        if (!eof && (avail * 8 - bit_offset) / max_length < want)
+            want = (avail * 8 - bit_offset) / max_length;
+        
+        if (want > remaining)
+            want = (size_t) remaining;
+        
+        bitreader_init(&br, inbuf, avail, bit_offset);
+        if (0 != run_decoder(dec, cdec, &br, outbuf, want))
+        {
+            ret = -10;
+            break;
+        }
+        
+        if (bitreader_overrun(&br))
+        {
+            ret = -8;
+            break;
+        }
+        
+        if (NULL != checksum)
+            crc = huffman_crc32c(crc, outbuf, want);
+        
+        if (want != huffman_io_write(out, outbuf, want))
+        {
+            ret = -5;
+            break;
+        }
+        
+        remaining -= want;
+        consumed = bitreader_tell(&br);
+        memmove(inbuf, inbuf + consumed / 8, avail - consumed / 8);
+        avail -= consumed / 8;
+        bit_offset = consumed % 8;
+    }
+    
+    if (0 == ret && NULL != checksum && huffman_get_le(checksum, 4) != crc)
+        ret = -12;
+    
+    free(inbuf);
+    free(outbuf);
+    return ret;
+}
+
+static int decode_file_block(
+    huffman_io_t* in,
+    huffman_io_t* out,
+    huffman_decoder_t* dec,
+    huffman_compact_decoder_t* cdec,
+    int flags
+)
+{
+    uint8_t header[HUFFMAN_BLOCK_HEADER_SIZE + HUFFMAN_CHECKSUM_SIZE];
+    uint8_t table[HUFFMAN_TABLE_BYTES(HUFFMAN_RLE_ALPHABET_SIZE)];
+    huffman_codetab_t* slots[HUFFMAN_TABLE_CACHE_MAX_SLOTS];
+    uint8_t* inbuf = NULL;
+    uint8_t* outbuf = NULL;
+    size_t in_cap = 0, out_cap = 0, header_size = HUFFMAN_BLOCK_HEADER_SIZE;
+    size_t symbols = HUFFMAN_ASCII_BYTE_CHARTAB_SIZE;
+    uint32_t file_crc = 0;
+    int current = -1, built = -1, ret = 0;
+    int i = 0;
+    
+    if (flags & HUFFMAN_FLAG_CHECKSUM)
+        header_size += HUFFMAN_CHECKSUM_SIZE;
+    
+    /* Run symbols are only known to the full decoder. */
+    if (flags & HUFFMAN_FLAG_RLE)
+    {
+        if (NULL == dec)
+            return -1;
+        
+        symbols = HUFFMAN_RLE_ALPHABET_SIZE;
+        cdec = NULL;
+    }
+    
+    for (i = 0; i < HUFFMAN_TABLE_CACHE_MAX_SLOTS; i++)
+        slots[i] = NULL;
+    
+    for (;;)
+    {
+        bitreader_t br;
+        size_t raw_size = 0, payload_size = 0;
+        int kind = 0, slot = 0;
+        
+        if (header_size != huffman_io_read(in, header, header_size))
+        {
+            ret = -8;
+            break;
+        }
+        
+        raw_size = (size_t) huffman_get_le(header, 4);
+        payload_size = (size_t) huffman_get_le(header + 4, 4);
+        if (0 == raw_size)
+        {
+            if (header_size > HUFFMAN_BLOCK_HEADER_SIZE &&
+                huffman_get_le(header + HUFFMAN_BLOCK_HEADER_SIZE, 4) != file_crc)
+                ret = -12;
+            
+            break;
+        }
+        
+        if (raw_size > HUFFMAN_MAX_BLOCK_SIZE ||
+            payload_size > huffman_encode_bound(raw_size))
+        {
+            ret = -9;
+            break;
+        }
+        
+        kind = header[8] & 0x0f;
+        slot = header[8] >> 4;
+        if (HUFFMAN_BLOCK_TABLE_INLINE == kind)
+        {
+            if (NULL == slots[slot])
+                slots[slot] = huffman_codetab_create(symbols);
+            
+            if (NULL == slots[slot])
+            {
+                ret = -7;
+                break;
+            }
+            
+            if (HUFFMAN_TABLE_BYTES(symbols) !=
+                huffman_io_read(in, table, HUFFMAN_TABLE_BYTES(symbols)))
+            {
+                ret = -8;
+                break;
+            }
+            
+            if (0 != huffman_table_read(slots[slot], table))
+            {
+                ret = -9;
+                break;
+            }
+            
+            current = slot;
+            built = -1;
+        }
+        
+        else if (HUFFMAN_BLOCK_TABLE_CACHED == kind && NULL != slots[slot])
+            current = slot;
+        
+        else if (HUFFMAN_BLOCK_TABLE_REPEAT != kind || current < 0)
+        {
+            ret = -9;
+            break;
+        }
+        
+        /* Decode tables are only rebuilt when the block switches table. */
+        if (built != current)
+        {
+            if (0 != build_decoder(dec, cdec, slots[current]))
+            {
+                ret = -9;
+                break;
+            }
+            
+            built = current;
+        }
+        
+        if (payload_size > in_cap)
+        {
+            free(inbuf);
+            in_cap = payload_size;
+            inbuf = (uint8_t*) malloc(in_cap);
+        }
+        
+        if (raw_size > out_cap)
+        {
+            free(outbuf);
+            out_cap = raw_size;
+            outbuf = (uint8_t*) malloc(out_cap);
+        }
+        
+        if (NULL == inbuf || NULL == outbuf)
+        {
+            ret = -7;
+            break;
+        }
+        
+        if (payload_size != huffman_io_read(in, inbuf, payload_size))
+        {
+            ret = -8;
+            break;
+        }
+        
+        bitreader_init(&br, inbuf, payload_size, 0);
+        if (0 != ((flags & HUFFMAN_FLAG_RLE) ?
+                  huffman_rle_decode(dec, &br, outbuf, raw_size) :
+                  run_decoder(dec, cdec, &br, outbuf, raw_size)))
+        {
+            ret = -10;
+            break;
+        }
+        
+        if (bitreader_overrun(&br))
+        {
+            ret = -8;
+            break;
+        }
+        
+        /* Verified before it is written, while still in cache. */
+        if (header_size > HUFFMAN_BLOCK_HEADER_SIZE)
+        {
+            uint32_t crc = huffman_crc32c(0, outbuf, raw_size);
+            
+            if (huffman_get_le(header + HUFFMAN_BLOCK_HEADER_SIZE, 4) != crc)
+            {
+                ret = -12;
+                break;
+            }
+            
+            file_crc = huffman_crc32c_combine(file_crc, crc, raw_size);
+        }
+        
+        if (raw_size != huffman_io_write(out, outbuf, raw_size))
+        {
+            ret = -5;
+            break;
+        }
+    }
+    
+    for (i = 0; i < HUFFMAN_TABLE_CACHE_MAX_SLOTS; i++)
+        huffman_codetab_free(slots[i]);
+    
+    free(inbuf);
+    free(outbuf);
+    return ret;
+}
+
+/* Decodes each field's column and puts it back into the block's records. */
+static int decode_file_record(
+    huffman_io_t* in,
+    huffman_io_t* out,
+    huffman_codetab_t* ct,
+    huffman_decoder_t* dec,
+    huffman_compact_decoder_t* cdec,
+    int flags
+)
+{
+    uint8_t header[4 + HUFFMAN_CHECKSUM_SIZE];
+    uint8_t table[4 + HUFFMAN_TABLE_BYTES(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE)];
+    uint8_t fields[1 + 2 * HUFFMAN_RECORD_MAX_FIELDS];
+    size_t widths[HUFFMAN_RECORD_MAX_FIELDS];
+    huffman_record_layout_t layout;
+    uint8_t* inbuf = NULL;
+    uint8_t* outbuf = NULL;
+    uint8_t* column = NULL;
+    size_t in_cap = 0, out_cap = 0, header_size = 4;
+    uint32_t file_crc = 0;
+    int ret = 0, i = 0;
+    
+    if (flags & HUFFMAN_FLAG_CHECKSUM)
+        header_size += HUFFMAN_CHECKSUM_SIZE;
+    
+    if (1 != huffman_io_read(in, fields, 1))
+        return -8;
+    
+    if (0 == fields[0] || fields[0] > HUFFMAN_RECORD_MAX_FIELDS)
+        return -9;
+    
+    if ((size_t) 2 * fields[0] != huffman_io_read(in, fields + 1,
+                                                  2 * fields[0]))
+        return -8;
+    
+    for (i = 0; i < fields[0]; i++)
+        widths[i] = (size_t) huffman_get_le(fields + 1 + 2 * i, 2);
+    
+    if (0 != huffman_record_layout_init(&layout, widths, fields[0]))
+        return -9;
+    
+    for (;;)
+    {
+        size_t raw_size = 0;
+        
+        if (header_size != huffman_io_read(in, header, header_size))
+        {
+            ret = -8;
+            break;
+        }
+        
+        raw_size = (size_t) huffman_get_le(header, 4);
+        if (0 == raw_size)
+        {
+            if (header_size > 4 && huffman_get_le(header + 4, 4) != file_crc)
+                ret = -12;
+            
+            break;
+        }
+        
+        if (raw_size > HUFFMAN_MAX_BLOCK_SIZE)
+        {
+            ret = -9;
+            break;
+        }
+        
+        if (raw_size > out_cap)
+        {
+            free(outbuf);
+            free(column);
+            out_cap = raw_size;
+            outbuf = (uint8_t*) malloc(out_cap);
+            column = (uint8_t*) malloc(out_cap);
+            if (NULL == outbuf || NULL == column)
+            {
+                ret = -7;
+                break;
+            }
+        }
+        
+        for (i = 0; 0 == ret && i < layout.fields; i++)
+        {
+            bitreader_t br;
+            size_t m = huffman_record_column_size(&layout, i, raw_size);
+            size_t payload_size = 0;
+            
+            if (sizeof(table) != huffman_io_read(in, table, sizeof(table)))
+            {
+                ret = -8;
+                break;
+            }
+            
+            payload_size = (size_t) huffman_get_le(table, 4);
+            if (payload_size > huffman_encode_bound(m) ||
+                0 != huffman_table_read(ct, table + 4) ||
+                0 != build_decoder(dec, cdec, ct))
+            {
+                ret = -9;
+                break;
+            }
+            
+            if (payload_size > in_cap)
+            {
+                free(inbuf);
+                in_cap = payload_size;
+                inbuf = (uint8_t*) malloc(in_cap);
+                if (NULL == inbuf)
+                {
+                    ret = -7;
+                    break;
+                }
+            }
+            
+            if (payload_size != huffman_io_read(in, inbuf, payload_size))
+            {
+                ret = -8;
+                break;
+            }
+            
+            bitreader_init(&br, inbuf, payload_size, 0);
+            if (0 != run_decoder(dec, cdec, &br, column, m))
+            {
+                ret = -10;
+                break;
+            }
+            
+            if (bitreader_overrun(&br))
+            {
+                ret = -8;
+                break;
+            }
+            
+            huffman_record_scatter(&layout, i, column, outbuf, raw_size);
+        }
+        
+        if (0 != ret)
+            break;
+        
+        if (header_size > 4)
+        {
+            uint32_t crc = huffman_crc32c(0, outbuf, raw_size);
+            
+            if (huffman_get_le(header + 4, 4) != crc)
+            {
+                ret = -12;
+                break;
+            }
+            
+            file_crc = huffman_crc32c_combine(file_crc, crc, raw_size);
+        }
+        
+        if (raw_size != huffman_io_write(out, outbuf, raw_size))
+        {
+            ret = -5;
+            break;
+        }
+    }
+    
+    free(inbuf);
+    free(outbuf);
+    free(column);
+    return ret;
+}
+
+int huffman_decode_file(FILE* in, FILE* out, const huffman_options_t* opt)
+{
+    huffman_options_t defaults;
+    uint8_t header[HUFFMAN_FILE_HEADER_SIZE];
+    huffman_io_t* src = NULL;
+    huffman_io_t* dst = NULL;
+    huffman_codetab_t* ct = NULL;
+    huffman_decoder_t* dec = NULL;
+    huffman_compact_decoder_t* cdec = NULL;
+    int ret = 0;
+    
+    if (NULL == in || NULL == out)
+        return -1;
+    
+    if (NULL == opt)
+    {
+        huffman_options_init(&defaults);
+        opt = &defaults;
+    }
+    
+    src = huffman_io_open(in, 0, opt->io, opt->io_depth);
+    dst = huffman_io_open(out, 1, opt->io, opt->io_depth);
+    ct = huffman_codetab_create(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE);
+    if (NULL == src || NULL == dst || NULL == ct)
+        ret = -7;
+    
+    else if (HUFFMAN_FILE_HEADER_SIZE !=
+        huffman_io_read(src, header, HUFFMAN_FILE_HEADER_SIZE))
+        ret = -8;
+    
+    else if (0 != memcmp(header, HUFFMAN_MAGIC, 4) ||
+        HUFFMAN_FORMAT_VERSION != header[4] ||
+        0 != (header[6] & ~(HUFFMAN_FLAG_CHECKSUM | HUFFMAN_FLAG_RLE)) ||
+        ((header[6] & HUFFMAN_FLAG_RLE) && HUFFMAN_MODE_BLOCK != header[5]))
+        ret = -9;
+    
+    else
+    {
+        /* Run length files always take the full decoder, see rle.h. */
+        if (opt->compact && !(header[6] & HUFFMAN_FLAG_RLE))
+            cdec = huffman_compact_decoder_create();
+        else
+            dec = huffman_decoder_create();
+        
+        if (NULL == dec && NULL == cdec)
+            ret = -7;
+        else if (HUFFMAN_MODE_STREAM == header[5])
+            ret = decode_file_stream(src, dst, ct, dec, cdec, header[6],
+                                     opt->threads);
+        else if (HUFFMAN_MODE_BLOCK == header[5])
+            ret = decode_file_block(src, dst, dec, cdec, header[6]);
+        else if (HUFFMAN_MODE_RECORD == header[5])
+            ret = decode_file_record(src, dst, ct, dec, cdec, header[6]);
+        else
+            ret = -9;
+    }
+    
+    if (NULL != src && 0 != huffman_io_close(src) && 0 == ret)
+        ret = -2;
+    
+    if (NULL != dst && 0 != huffman_io_close(dst) && 0 == ret)
+        ret = -5;
+    
+    huffman_compact_decoder_free(cdec);
+    huffman_decoder_free(dec);
+    huffman_codetab_free(ct);
+    return ret;
+}
+
+huffman_context_t* huffman_context_create(const huffman_codetab_t* preset)
+{
+    huffman_context_t* ctx = (huffman_context_t*)
+        malloc(sizeof(huffman_context_t));
+    
+    if (NULL == ctx)
+        return NULL;
+    
+    ctx->preset = preset;
+    ctx->preset_id = NULL != preset ? huffman_preset_id(preset) : 0;
+    ctx->dec_source = NULL;
+    ctx->tab = chartab_create(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE);
+    ctx->ct = huffman_codetab_create(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE);
+    ctx->dec = huffman_decoder_create();
+    if (NULL == ctx->tab || NULL == ctx->ct || NULL == ctx->dec)
+    {
+        huffman_context_free(ctx);
+        return NULL;
+    }
+    
+    return ctx;
+}
+
+void huffman_context_free(huffman_context_t* ctx)
+{
+    if (NULL == ctx)
+        return;
+    
+    chartab_free(ctx->tab);
+    huffman_codetab_free(ctx->ct);
+    huffman_decoder_free(ctx->dec);
+    free(ctx);
+    return;
+}
+
+/* A table from sample statistics, with every byte given a code. */
+huffman_codetab_t* huffman_preset_train(const chartab_t* sample)
+{
+    huffman_codetab_t* ct = NULL;
+    chartab_t* tab = NULL;
+    size_t i = 0;
+    
+    tab = chartab_create(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE);
+    ct = huffman_codetab_create(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE);
+    if (NULL == tab || NULL == ct)
+    {
+        chartab_free(tab);
+        huffman_codetab_free(ct);
+        return NULL;
+    }
+    
+    if (NULL != sample)
+        chartab_merge(tab, sample);
+    
+    for (i = 0; i < tab->size; i++)
+        tab->items[i].count += 1;
+    
+    if (0 != huffman_codetab_build(ct, tab, HUFFMAN_MAX_CODE_LENGTH))
+    {
+        huffman_codetab_free(ct);
+        ct = NULL;
+    }
+    
+    chartab_free(tab);
+    return ct;
+}
+
+/* Names a preset in PRESET blocks, so a peer with another one notices. */
+uint32_t huffman_preset_id(const huffman_codetab_t* preset)
+{
+    uint8_t table[HUFFMAN_TABLE_BYTES(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE)];
+    
+    if (NULL == preset || preset->size > HUFFMAN_ASCII_BYTE_CHARTAB_SIZE)
+        return 0;
+    
+    return huffman_crc32c(0, table, huffman_table_write(preset, table));
+}
+
+size_t huffman_compress_bound(size_t raw_size)
+{
+    size_t blocks = raw_size / HUFFMAN_DEFAULT_BLOCK_SIZE + 1;
+    
+    return huffman_encode_bound(raw_size) + HUFFMAN_BLOCK_HEADER_SIZE +
+        blocks * (HUFFMAN_BLOCK_HEADER_SIZE +
+            HUFFMAN_TABLE_BYTES(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE) + 16);
+}
+
+int huffman_compress(
+    huffman_context_t* ctx,
+    const uint8_t* in,
+    size_t in_size,
+    uint8_t* out,
+    size_t out_cap,
+    size_t* out_size
+)
+{
+    size_t done = 0, pos = 0;
+    
+    if (NULL == ctx || NULL == out || NULL == out_size ||
+        (NULL == in && in_size > 0))
+        return -1;
+    
+    while (done < in_size)
+    {
+        const huffman_codetab_t* use = ctx->ct;
+        size_t n = in_size - done, header_size = HUFFMAN_BLOCK_HEADER_SIZE;
+        int kind = HUFFMAN_BLOCK_TABLE_INLINE;
+        bitwriter_t bw;
+        
+        if (n > HUFFMAN_DEFAULT_BLOCK_SIZE)
+            n = HUFFMAN_DEFAULT_BLOCK_SIZE;
+        
+        chartab_clear(ctx->tab);
+        chartab_accumulate(ctx->tab, in + done, n);
+        
+        /* Small payloads can rarely pay for a table of their own. */
+        if (NULL != ctx->preset &&
+            (double) huffman_codetab_cost(ctx->preset, ctx->tab) <=
+                chartab_entropy_bits(ctx->tab) +
+                8.0 * HUFFMAN_TABLE_BYTES(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE))
+        {
+            kind = HUFFMAN_BLOCK_TABLE_PRESET;
+            use = ctx->preset;
+        }
+        
+        else if (0 != huffman_codetab_build(ctx->ct, ctx->tab,
+                                            HUFFMAN_MAX_CODE_LENGTH))
+            return -4;
+        
+        if (HUFFMAN_BLOCK_TABLE_INLINE == kind)
+            header_size += HUFFMAN_TABLE_BYTES(use->size);
+        else
+            header_size += HUFFMAN_PRESET_ID_SIZE;
+        
+        if (out_cap - pos < header_size + HUFFMAN_BLOCK_HEADER_SIZE)
+            return -3;
+        
+        bitwriter_init(&bw, out + pos + header_size,
+                       out_cap - pos - header_size - HUFFMAN_BLOCK_HEADER_SIZE);
+        if (0 != huffman_encode_symbols(use, in + done, n, &bw) ||
+            0 != bitwriter_flush(&bw))
+            return -3;
+        
+        huffman_put_le(out + pos, n, 4);
+        huffman_put_le(out + pos + 4, bw.pos, 4);
+        out[pos + 8] = (uint8_t) kind;
+        if (HUFFMAN_BLOCK_TABLE_INLINE == kind)
+            huffman_table_write(use, out + pos + HUFFMAN_BLOCK_HEADER_SIZE);
+        else
+            huffman_put_le(out + pos + HUFFMAN_BLOCK_HEADER_SIZE, ctx->preset_id,
+                   HUFFMAN_PRESET_ID_SIZE);
+        
+        pos += header_size + bw.pos;
+        done += n;
+    }
+    
+    if (out_cap - pos < HUFFMAN_BLOCK_HEADER_SIZE)
+        return -3;
+    
+    memset(out + pos, 0, HUFFMAN_BLOCK_HEADER_SIZE);
+    *out_size = pos + HUFFMAN_BLOCK_HEADER_SIZE;
+    return 0;
+}
+
+int huffman_decompressed_size(
+    const uint8_t* in,
+    size_t in_size,
+    size_t* raw_size
+)
+{
+    size_t pos = 0, total = 0;
+    
+    if (NULL == in || NULL == raw_size)
+        return -1;
+    
+    for (;;)
+    {
+        size_t n = 0, payload = 0;
+        
+        if (in_size - pos < HUFFMAN_BLOCK_HEADER_SIZE)
+            return -8;
+        
+        n = (size_t) huffman_get_le(in + pos, 4);
+        payload = (size_t) huffman_get_le(in + pos + 4, 4);
+        if (0 == n)
+            break;
+        
+        pos += HUFFMAN_BLOCK_HEADER_SIZE;
+        if (HUFFMAN_BLOCK_TABLE_INLINE == (in[pos - 1] & 0x0f))
+            pos += HUFFMAN_TABLE_BYTES(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE);
+        else if (HUFFMAN_BLOCK_TABLE_PRESET == (in[pos - 1] & 0x0f))
+            pos += HUFFMAN_PRESET_ID_SIZE;
+        
+        if (pos > in_size || in_size - pos < payload)
+            return -8;
+        
+        pos += payload;
+        total += n;
+    }
+    
+    *raw_size = total;
+    return 0;
+}
+
+int huffman_decompress(
+    huffman_context_t* ctx,
+    const uint8_t* in,
+    size_t in_size,
+    uint8_t* out,
+    size_t out_cap,
+    size_t* out_size
+)
+{
+    size_t pos = 0, done = 0;
+    
+    if (NULL == ctx || NULL == in || NULL == out_size ||
+        (NULL == out && out_cap > 0))
+        return -1;
+    
+    for (;;)
+    {
+        const huffman_codetab_t* use = NULL;
+        size_t n = 0, payload = 0;
+        int kind = 0;
+        bitreader_t br;
+        
+        if (in_size - pos < HUFFMAN_BLOCK_HEADER_SIZE)
+            return -8;
+        
+        n = (size_t) huffman_get_le(in + pos, 4);
+        payload = (size_t) huffman_get_le(in + pos + 4, 4);
+        kind = in[pos + 8] & 0x0f;
+        pos += HUFFMAN_BLOCK_HEADER_SIZE;
+        if (0 == n)
+            break;
+        
+        if (n > out_cap - done || payload > huffman_encode_bound(n))
+            return -9;
+        
+        if (HUFFMAN_BLOCK_TABLE_INLINE == kind)
+        {
+            if (in_size - pos < HUFFMAN_TABLE_BYTES(ctx->ct->size))
+                return -8;
+            
+            if (0 != huffman_table_read(ctx->ct, in + pos))
+                return -9;
+            
+            pos += HUFFMAN_TABLE_BYTES(ctx->ct->size);
+            use = ctx->ct;
+            ctx->dec_source = NULL;
+        }
+        
+        else if (HUFFMAN_BLOCK_TABLE_PRESET == kind)
+        {
+            if (in_size - pos < HUFFMAN_PRESET_ID_SIZE)
+                return -8;
+            
+            /* Coded with a preset this side does not have. */
+            if (NULL == ctx->preset ||
+                ctx->preset_id != huffman_get_le(in + pos, HUFFMAN_PRESET_ID_SIZE))
+                return -13;
+            
+            pos += HUFFMAN_PRESET_ID_SIZE;
+            use = ctx->preset;
+        }
+        
+        else
+            return -9;
+        
+        if (use != ctx->dec_source)
+        {
+            if (0 != huffman_decoder_build(ctx->dec, use))
+                return -9;
+            
+            /* Only a preset stays valid across calls. */
+            ctx->dec_source = use == ctx->preset ? use : NULL;
+        }
+        
+        if (in_size - pos < payload)
+            return -8;
+        
+        bitreader_init(&br, in + pos, payload, 0);
+        if (0 != huffman_decode_symbols(ctx->dec, &br, out + done, n))
+            return -10;
+        
+        if (bitreader_overrun(&br))
+            return -8;
+        
+        pos += payload;
+        done += n;
+    }
+    
+    *out_size = done;
+    return 0;
+}
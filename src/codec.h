@@ -0,0 +1,201 @@
+#ifndef ___huffman__codec_h___
+#define ___huffman__codec_h___
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "bitstream.h"
+#include "huffman.h"
+#include "io.h"
+#include "record.h"
+
+/*
+ * Encoded file layout, all integers little endian:
+ *
+ *   file header   "HUFZ" version(1) mode(1) flags(1) reserved(1)
+ *
+ * HUFFMAN_MODE_STREAM, one table for the whole file:
+ *   raw_size(8) [crc(4)] table payload...
+ *
+ * HUFFMAN_MODE_BLOCK, one table per block, ended by a zero sized block:
+ *   raw_size(4) payload_size(4) table_kind(1) [crc(4)] [table] payload
+ *   0(4) 0(4) 0(1) [crc(4)]
+ *
+ * HUFFMAN_MODE_RECORD, fixed size records cut into fields, see record.h,
+ * with one table per field and block:
+ *   field_count(1) width(2)...
+ *   raw_size(4) [crc(4)] { payload_size(4) table payload } per field
+ *   0(4) [crc(4)]
+ * Blocks hold whole records but the last, and each field's payload codes
+ * that field's column of the block.
+ *
+ * The crc fields are only there with HUFFMAN_FLAG_CHECKSUM. They are
+ * CRC32C of the uncompressed bytes: of the block in a block header, of
+ * the whole file in the stream header and after the final block.
+ *
+ * HUFFMAN_FLAG_RLE, block mode only, codes every block over the run
+ * length alphabet of rle.h, so tables hold HUFFMAN_RLE_ALPHABET_SIZE
+ * lengths instead of 256.
+ *
+ * The low nibble of table_kind says where the block's table comes from,
+ * the high nibble is a table slot:
+ *   HUFFMAN_BLOCK_TABLE_INLINE  table follows, decoder stores it in slot
+ *   HUFFMAN_BLOCK_TABLE_REPEAT  no table, same table as the block before
+ *   HUFFMAN_BLOCK_TABLE_CACHED  no table, the one stored in slot earlier
+ *   HUFFMAN_BLOCK_TABLE_PRESET  no table, a table both sides agreed on
+ *
+ * huffman_compress() produces the block sequence alone, without the file
+ * header, for payloads exchanged in memory. Its PRESET blocks carry the
+ * preset's id in place of the table, and a decoder holding a different
+ * preset fails with -13:
+ *   raw_size(4) payload_size(4) table_kind(1) preset_id(4) payload
+ * The id is huffman_preset_id(), the CRC32C of the preset's table bytes.
+ *
+ * A table is the code length of every symbol packed two per byte, high
+ * nibble first. Codes are canonical, see huffman_codetab_assign_codes().
+ */
+#define HUFFMAN_MAGIC               "HUFZ"
+#define HUFFMAN_FORMAT_VERSION      1
+#define HUFFMAN_FILE_HEADER_SIZE    8
+
+#define HUFFMAN_MODE_STREAM         0
+#define HUFFMAN_MODE_BLOCK          1
+#define HUFFMAN_MODE_RECORD         2
+
+#define HUFFMAN_FLAG_CHECKSUM       0x01
+#define HUFFMAN_FLAG_RLE            0x02
+#define HUFFMAN_CHECKSUM_SIZE       4
+
+#define HUFFMAN_BLOCK_HEADER_SIZE   9
+#define HUFFMAN_BLOCK_TABLE_INLINE  0
+#define HUFFMAN_BLOCK_TABLE_REPEAT  1
+#define HUFFMAN_BLOCK_TABLE_CACHED  2
+#define HUFFMAN_BLOCK_TABLE_PRESET  3
+#define HUFFMAN_PRESET_ID_SIZE      4
+
+#define HUFFMAN_TABLE_CACHE_DEFAULT_SLOTS   8
+
+/* Blocks of history the -d drift check compares against. */
+#define HUFFMAN_DRIFT_WINDOW_BLOCKS 4
+
+/* Sized to stay resident in a typical L2 while it is counted and coded. */
+#define HUFFMAN_DEFAULT_BLOCK_SIZE  (256 * 1024)
+#define HUFFMAN_MAX_BLOCK_SIZE      (64 * 1024 * 1024)
+
+#define HUFFMAN_TABLE_BYTES(size)   (((size) + 1) / 2)
+
+struct huffman_decoder_s
+{
+    int bits;
+    uint16_t* table;
+};
+
+typedef struct huffman_decoder_s huffman_decoder_t;
+
+struct huffman_options_s
+{
+    int mode;
+    size_t block_size;
+    int reuse_drift;    /* chartab_drift() limit to keep a table, <0 never */
+    size_t table_cache; /* table slots the encoder may point back to */
+    int threads;        /* decoder threads for a single stream */
+    int io;             /* HUFFMAN_IO_* file backend */
+    int io_depth;       /* transfers in flight for HUFFMAN_IO_URING */
+    int compact;        /* decode with huffman_compact_decoder_t */
+    int checksum;       /* encoder stores CRC32C, HUFFMAN_FLAG_CHECKSUM */
+    size_t rle;         /* shortest run coded as a run, 0 off, block mode */
+    huffman_record_layout_t record; /* fields of HUFFMAN_MODE_RECORD */
+};
+
+typedef struct huffman_options_s huffman_options_t;
+
+void huffman_options_init(huffman_options_t* opt);
+
+/* Little endian integers of nbytes, as every header above stores them. */
+void huffman_put_le(uint8_t* p, uint64_t value, int nbytes);
+
+uint64_t huffman_get_le(const uint8_t* p, int nbytes);
+
+size_t huffman_encode_bound(size_t raw_size);
+
+size_t huffman_table_write(const huffman_codetab_t* ct, uint8_t* buf);
+
+int huffman_table_read(huffman_codetab_t* ct, const uint8_t* buf);
+
+int huffman_encode_symbols(
+    const huffman_codetab_t* ct,
+    const uint8_t* in,
+    size_t in_size,
+    bitwriter_t* bw
+);
+
+huffman_decoder_t* huffman_decoder_create(void);
+
+void huffman_decoder_free(huffman_decoder_t* dec);
+
+int huffman_decoder_build(huffman_decoder_t* dec, const huffman_codetab_t* ct);
+
+int huffman_decode_symbols(
+    const huffman_decoder_t* dec,
+    bitreader_t* br,
+    uint8_t* out,
+    size_t count
+);
+
+/*
+ * Reusable state for in-memory coding so repeated calls do not allocate.
+ * preset is borrowed, it must outlive the context and be shared by both
+ * ends; huffman_preset_train() makes one that can code any byte.
+ */
+struct huffman_context_s
+{
+    chartab_t* tab;
+    huffman_codetab_t* ct;
+    huffman_decoder_t* dec;
+    const huffman_codetab_t* dec_source;
+    const huffman_codetab_t* preset;
+    uint32_t preset_id;
+};
+
+typedef struct huffman_context_s huffman_context_t;
+
+huffman_context_t* huffman_context_create(const huffman_codetab_t* preset);
+
+void huffman_context_free(huffman_context_t* ctx);
+
+huffman_codetab_t* huffman_preset_train(const chartab_t* sample);
+
+uint32_t huffman_preset_id(const huffman_codetab_t* preset);
+
+size_t huffman_compress_bound(size_t raw_size);
+
+int huffman_compress(
+    huffman_context_t* ctx,
+    const uint8_t* in,
+    size_t in_size,
+    uint8_t* out,
+    size_t out_cap,
+    size_t* out_size
+);
+
+int huffman_decompressed_size(
+    const uint8_t* in,
+    size_t in_size,
+    size_t* raw_size
+);
+
+int huffman_decompress(
+    huffman_context_t* ctx,
+    const uint8_t* in,
+    size_t in_size,
+    uint8_t* out,
+    size_t out_cap,
+    size_t* out_size
+);
+
+int huffman_encode_file(FILE* in, FILE* out, const huffman_options_t* opt);
+
+int huffman_decode_file(FILE* in, FILE* out, const huffman_options_t* opt);
+
+#endif
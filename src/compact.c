@@ -0,0 +1,131 @@
+#include "compact.h"
+
+#include <string.h>
+
+#define LOOKUP_BITS HUFFMAN_COMPACT_LOOKUP_BITS
+
+huffman_compact_decoder_t* huffman_compact_decoder_create(void)
+{
+    huffman_compact_decoder_t* dec = (huffman_compact_decoder_t*)
+        malloc(sizeof(huffman_compact_decoder_t));
+    
+    if (NULL != dec)
+        memset(dec, 0, sizeof(huffman_compact_decoder_t));
+    
+    return dec;
+}
+
+void huffman_compact_decoder_free(huffman_compact_decoder_t* dec)
+{
+    free(dec);
+}
+
+int huffman_compact_decoder_build(
+    huffman_compact_decoder_t* dec,
+    const huffman_codetab_t* ct
+)
+{
+    uint16_t count[HUFFMAN_MAX_CODE_LENGTH + 1];
+    uint16_t next[HUFFMAN_MAX_CODE_LENGTH + 1];
+    uint32_t code = 0, offset = 0;
+    size_t i = 0;
+    int len = 0;
+    
+    if (NULL == dec || NULL == ct)
+        return -1;
+    
+    if (ct->size > HUFFMAN_ASCII_BYTE_CHARTAB_SIZE ||
+        ct->max_length > HUFFMAN_MAX_CODE_LENGTH)
+        return -2;
+    
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < ct->size; i++)
+        count[ct->lengths[i]] += 1;
+    
+    /* Same first codes as huffman_codetab_assign_codes() hands out. */
+    count[0] = 0;
+    for (len = 1; len <= HUFFMAN_MAX_CODE_LENGTH; len++)
+    {
+        code = (code + count[len - 1]) << 1;
+        dec->limit[len] = (uint16_t) (code + count[len]);
+        dec->base[len] = (uint16_t) (offset - code);
+        next[len] = (uint16_t) offset;
+        offset += count[len];
+    }
+    
+    memset(dec->lengths, 0, sizeof(dec->lengths));
+    for (i = 0; i < ct->size; i++)
+    {
+        uint32_t first = 0, n = 0, k = 0;
+        
+        len = ct->lengths[i];
+        if (0 == len)
+            continue;
+        
+        dec->symbols[next[len]++] = (uint8_t) i;
+        if (len > LOOKUP_BITS)
+            continue;
+        
+        first = ct->codes[i] << (LOOKUP_BITS - len);
+        n = (uint32_t) 1 << (LOOKUP_BITS - len);
+        for (k = first; k < first + n; k++)
+            dec->lengths[k >> 1] |= (uint8_t) (len << ((k & 1) << 2));
+    }
+    
+    dec->max_length = ct->max_length > 0 ? ct->max_length : 1;
+    return 0;
+}
+
+int huffman_compact_decode_symbols(
+    const huffman_compact_decoder_t* dec,
+    bitreader_t* br,
+    uint8_t* out,
+    size_t count
+)
+{
+    size_t i = 0, n = 0;
+    
+    if (NULL == dec || NULL == br || (NULL == out && count > 0))
+        return -1;
+    
+    while (i < count)
+    {
+        bitreader_refill(br);
+        n = (size_t) (br->count / dec->max_length);
+        if (n > count - i)
+            n = count - i;
+        
+        for (; n > 0; n--)
+        {
+            /*
+             * Bits past count are zeros or the right input, and a code
+             * shorter than the lookup owns every extension, so an 8-bit
+             * peek is safe even with fewer bits left.
+             */
+            uint32_t bits = BITREADER_PEEK(br, LOOKUP_BITS);
+            uint32_t code = 0;
+            int len = (dec->lengths[bits >> 1] >> ((bits & 1) << 2)) & 0x0f;
+            
+            if (len > 0)
+                code = bits >> (LOOKUP_BITS - len);
+            
+            else
+            {
+                for (len = LOOKUP_BITS + 1; ; len++)
+                {
+                    if (len > dec->max_length)
+                        return -2;
+                    
+                    code = BITREADER_PEEK(br, len);
+                    if (code < dec->limit[len])
+                        break;
+                }
+            }
+            
+            out[i++] = dec->symbols[(uint16_t) (code + dec->base[len])];
+            BITREADER_CONSUME(br, len);
+        }
+    }
+    
+    return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef ___huffman__compact_h___
+#define ___huffman__compact_h___
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "bitstream.h"
+#include "huffman.h"
+
+#define HUFFMAN_COMPACT_LOOKUP_BITS 8
+
+/*
+ * Small-footprint decoder for byte alphabets, for processes that keep
+ * many streams open at once.
+ *
+ * Instead of one 2^max_length entry table (64 KiB at 15 bits) it uses
+ * the structure of canonical codes: the codes of one length are
+ * consecutive, and they start at a known first code. The first 8 bits
+ * of the input look up the code length in a table of nibbles. Codes
+ * longer than 8 bits are found by checking each longer length against
+ * its limit. The symbol is the code's rank among the codes of its
+ * length, counted from that length's start in the symbols sorted by
+ * (length, symbol).
+ *
+ * Per stream state is sizeof(huffman_compact_decoder_t), 452 bytes:
+ *   lengths   128  code length per 8-bit prefix, 0 when longer
+ *   symbols   256  symbols in canonical order
+ *   limit      32  one past the last code of each length
+ *   base       32  symbols index minus first code, per length
+ *   max_length  4
+ * plus a bitreader_t (40 bytes) while a block is being decoded.
+ */
+struct huffman_compact_decoder_s
+{
+    uint8_t lengths[(1 << HUFFMAN_COMPACT_LOOKUP_BITS) / 2];
+    uint8_t symbols[HUFFMAN_ASCII_BYTE_CHARTAB_SIZE];
+    uint16_t limit[HUFFMAN_MAX_CODE_LENGTH + 1];
+    uint16_t base[HUFFMAN_MAX_CODE_LENGTH + 1];
+    int max_length;
+};
+
+typedef struct huffman_compact_decoder_s huffman_compact_decoder_t;
+
+huffman_compact_decoder_t* huffman_compact_decoder_create(void);
+
+void huffman_compact_decoder_free(huffman_compact_decoder_t* dec);
+
+int huffman_compact_decoder_build(
+    huffman_compact_decoder_t* dec,
+    const huffman_codetab_t* ct
+);
+
+int huffman_compact_decode_symbols(
+    const huffman_compact_decoder_t* dec,
+    bitreader_t* br,
+    uint8_t* out,
+    size_t count
+);
+
+#endif
@@ -0,0 +1,450 @@
+#include "dispatch.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HUFFMAN_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#define HUFFMAN_ARM_DISPATCH 1
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/* CRC32C polynomial, bit reflected. */
+#define CRC32C_POLY 0x82f63b78u
+
+/* Keep every per-table count below 2^32. */
+#define HISTOGRAM_SLICE_SIZE ((size_t) 1 << 30)
+
+static void histogram_scalar(size_t* counts, const uint8_t* buf, size_t size)
+{
+    /* Four tables so repeated bytes don't serialize on one counter. */
+    uint32_t sub[4][256];
+    size_t i = 0, n = 0;
+    int k = 0;
+    
+    while (size > 0)
+    {
+        n = size < HISTOGRAM_SLICE_SIZE ? size : HISTOGRAM_SLICE_SIZE;
+        memset(sub, 0, sizeof(sub));
+        
+        for (i = 0; i + 4 <= n; i += 4)
+        {
+            sub[0][buf[i]] += 1;
+            sub[1][buf[i + 1]] += 1;
+            sub[2][buf[i + 2]] += 1;
+            sub[3][buf[i + 3]] += 1;
+        }
+        
+        for (; i < n; i++)
+            sub[0][buf[i]] += 1;
+        
+        for (k = 0; k < 256; k++)
+            counts[k] += sub[0][k] + sub[1][k] + sub[2][k] + sub[3][k];
+        
+        buf += n;
+        size -= n;
+    }
+}
+
+/*
+ * The decode loop is written once and inlined into each decode kernel,
+ * so it is compiled again for whatever target that kernel is built for.
+ */
+#if defined(__GNUC__)
+#define DECODE_LOOP_INLINE static __inline__ __attribute__((always_inline))
+#else
+#define DECODE_LOOP_INLINE static
+#endif
+
+DECODE_LOOP_INLINE int decode_loop(
+    const uint16_t* table,
+    int bits,
+    bitreader_t* br,
+    uint8_t* out,
+    size_t count
+)
+{
+    size_t i = 0, n = 0;
+    
+    while (i < count)
+    {
+        /* One refill leaves at least 56 bits, enough for n symbols. */
+        bitreader_refill(br);
+        n = (size_t) (br->count / bits);
+        if (n > count - i)
+            n = count - i;
+        
+        for (; n > 0; n--)
+        {
+            uint16_t entry = table[BITREADER_PEEK(br, bits)];
+            if (0 == (entry & 0x0f))
+                return -2;
+            
+            out[i++] = (uint8_t) (entry >> 4);
+            BITREADER_CONSUME(br, entry & 0x0f);
+        }
+    }
+    
+    return 0;
+}
+
+static int decode_scalar(
+    const uint16_t* table,
+    int bits,
+    bitreader_t* br,
+    uint8_t* out,
+    size_t count
+)
+{
+    return decode_loop(table, bits, br, out, count);
+}
+
+static uint32_t crc32c_table[8][256];
+
+/* x^(2^k) mod P, for moving a CRC past 2^k zero bits. */
+static uint32_t crc32c_x2n[64];
+
+/* a * b mod P, both reflected. */
+static uint32_t crc32c_multiply(uint32_t a, uint32_t b)
+{
+    uint32_t m = (uint32_t) 1 << 31, p = 0;
+    
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if (0 == (a & (m - 1)))
+                break;
+        }
+        
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    
+    return p;
+}
+
+static void crc32c_init_tables(void)
+{
+    uint32_t c = 0;
+    int n = 0, k = 0;
+    
+    for (n = 0; n < 256; n++)
+    {
+        c = (uint32_t) n;
+        for (k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        
+        crc32c_table[0][n] = c;
+    }
+    
+    for (n = 0; n < 256; n++)
+    {
+        c = crc32c_table[0][n];
+        for (k = 1; k < 8; k++)
+        {
+            c = crc32c_table[0][c & 0xff] ^ (c >> 8);
+            crc32c_table[k][n] = c;
+        }
+    }
+    
+    crc32c_x2n[0] = (uint32_t) 1 << 30;
+    for (k = 1; k < 64; k++)
+        crc32c_x2n[k] = crc32c_multiply(crc32c_x2n[k - 1], crc32c_x2n[k - 1]);
+}
+
+/* Slicing-by-8: eight table lookups per 8 bytes, no carried dependency. */
+static uint32_t crc32c_slice8(uint32_t crc, const uint8_t* buf, size_t size)
+{
+    const uint32_t (*t)[256] = crc32c_table;
+    
+    crc = ~crc;
+    for (; size >= 8; buf += 8, size -= 8)
+    {
+        uint32_t lo = crc ^ ((uint32_t) buf[0] | (uint32_t) buf[1] << 8 |
+            (uint32_t) buf[2] << 16 | (uint32_t) buf[3] << 24);
+        uint32_t hi = (uint32_t) buf[4] | (uint32_t) buf[5] << 8 |
+            (uint32_t) buf[6] << 16 | (uint32_t) buf[7] << 24;
+        
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+            t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^
+            t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    }
+    
+    for (; size > 0; buf++, size--)
+        crc = t[0][(crc ^ *buf) & 0xff] ^ (crc >> 8);
+    
+    return ~crc;
+}
+
+#ifdef HUFFMAN_X86_DISPATCH
+
+/*
+ * Eight sub-histograms fed from one 64-bit load per 8 bytes. The counting
+ * itself is scalar, the speedup over histogram_scalar comes from the
+ * wider split of the counters; AVX2 only folds the tables together.
+ */
+__attribute__((target("avx2")))
+static void histogram_wide(size_t* counts, const uint8_t* buf, size_t size)
+{
+    uint32_t sub[8][256];
+    uint32_t sum[8];
+    size_t i = 0, n = 0;
+    int j = 0, k = 0;
+    
+    while (size > 0)
+    {
+        n = size < HISTOGRAM_SLICE_SIZE ? size : HISTOGRAM_SLICE_SIZE;
+        memset(sub, 0, sizeof(sub));
+        
+        for (i = 0; i + 8 <= n; i += 8)
+        {
+            uint64_t word = 0;
+            memcpy(&word, buf + i, 8);
+            
+            sub[0][(uint8_t) word] += 1;
+            sub[1][(uint8_t) (word >> 8)] += 1;
+            sub[2][(uint8_t) (word >> 16)] += 1;
+            sub[3][(uint8_t) (word >> 24)] += 1;
+            sub[4][(uint8_t) (word >> 32)] += 1;
+            sub[5][(uint8_t) (word >> 40)] += 1;
+            sub[6][(uint8_t) (word >> 48)] += 1;
+            sub[7][(uint8_t) (word >> 56)] += 1;
+        }
+        
+        for (; i < n; i++)
+            sub[0][buf[i]] += 1;
+        
+        /* Fold the eight tables eight counters at a time. */
+        for (k = 0; k < 256; k += 8)
+        {
+            __m256i acc = _mm256_loadu_si256((const __m256i*) &sub[0][k]);
+            for (j = 1; j < 8; j++)
+                acc = _mm256_add_epi32(acc,
+                    _mm256_loadu_si256((const __m256i*) &sub[j][k]));
+            
+            _mm256_storeu_si256((__m256i*) sum, acc);
+            for (j = 0; j < 8; j++)
+                counts[k + j] += sum[j];
+        }
+        
+        buf += n;
+        size -= n;
+    }
+}
+
+/*
+ * decode_loop built for BMI2: the variable shifts in BITREADER_PEEK and
+ * BITREADER_CONSUME become shrx/shlx, which need neither CL nor flags,
+ * so consecutive symbols don't stall on the shift count.
+ */
+__attribute__((target("bmi2")))
+static int decode_bmi2(
+    const uint16_t* table,
+    int bits,
+    bitreader_t* br,
+    uint8_t* out,
+    size_t count
+)
+{
+    return decode_loop(table, bits, br, out, count);
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t* buf, size_t size)
+{
+#ifdef __x86_64__
+    uint64_t c = ~crc;
+    
+    for (; size >= 8; buf += 8, size -= 8)
+    {
+        uint64_t word = 0;
+        memcpy(&word, buf, 8);
+        c = _mm_crc32_u64(c, word);
+    }
+    
+    crc = (uint32_t) c;
+#else
+    crc = ~crc;
+#endif
+    
+    for (; size > 0; buf++, size--)
+        crc = _mm_crc32_u8(crc, *buf);
+    
+    return ~crc;
+}
+
+#endif
+
+#ifdef HUFFMAN_ARM_DISPATCH
+
+__attribute__((target("+crc")))
+static uint32_t crc32c_armv8(uint32_t crc, const uint8_t* buf, size_t size)
+{
+    crc = ~crc;
+    for (; size >= 8; buf += 8, size -= 8)
+    {
+        uint64_t word = 0;
+        memcpy(&word, buf, 8);
+        crc = __crc32cd(crc, word);
+    }
+    
+    for (; size > 0; buf++, size--)
+        crc = __crc32cb(crc, *buf);
+    
+    return ~crc;
+}
+
+#endif
+
+/* Best first, the scalar baseline last. */
+static const huffman_kernels_t kernel_tables[] =
+{
+#ifdef HUFFMAN_X86_DISPATCH
+    {
+        "avx2+bmi2",
+        HUFFMAN_CPU_AVX2 | HUFFMAN_CPU_BMI2 | HUFFMAN_CPU_SSE42,
+        histogram_wide,
+        decode_bmi2,
+        crc32c_sse42
+    },
+    {
+        "bmi2",
+        HUFFMAN_CPU_BMI2 | HUFFMAN_CPU_SSE42,
+        histogram_scalar,
+        decode_bmi2,
+        crc32c_sse42
+    },
+    {
+        "sse4.2",
+        HUFFMAN_CPU_SSE42,
+        histogram_scalar,
+        decode_scalar,
+        crc32c_sse42
+    },
+#endif
+#ifdef HUFFMAN_ARM_DISPATCH
+    {
+        "crc32",
+        HUFFMAN_CPU_CRC32,
+        histogram_scalar,
+        decode_scalar,
+        crc32c_armv8
+    },
+#endif
+    {
+        "scalar",
+        0,
+        histogram_scalar,
+        decode_scalar,
+        crc32c_slice8
+    }
+};
+
+#define KERNEL_TABLE_COUNT (sizeof(kernel_tables) / sizeof(kernel_tables[0]))
+
+static const huffman_kernels_t* selected_kernels = NULL;
+
+int huffman_cpu_features(void)
+{
+    int features = 0;
+    
+#ifdef HUFFMAN_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("bmi2"))
+        features |= HUFFMAN_CPU_BMI2;
+    
+    if (__builtin_cpu_supports("avx2"))
+        features |= HUFFMAN_CPU_AVX2;
+    
+    if (__builtin_cpu_supports("sse4.2"))
+        features |= HUFFMAN_CPU_SSE42;
+#endif
+
+#ifdef HUFFMAN_ARM_DISPATCH
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+        features |= HUFFMAN_CPU_CRC32;
+#endif
+    
+    return features;
+}
+
+const huffman_kernels_t* huffman_kernels_list(size_t* count)
+{
+    if (NULL != count)
+        *count = KERNEL_TABLE_COUNT;
+    
+    return kernel_tables;
+}
+
+int huffman_kernels_select(const char* name)
+{
+    int features = huffman_cpu_features();
+    size_t i = 0;
+    
+    /* Every table may fall back on them, filled before any is chosen. */
+    if (0 == crc32c_table[0][1])
+        crc32c_init_tables();
+    
+    for (i = 0; i < KERNEL_TABLE_COUNT; i++)
+    {
+        const huffman_kernels_t* k = &kernel_tables[i];
+        
+        if (k->required_features != (k->required_features & features))
+            continue;
+        
+        if (NULL == name || !strcmp(name, k->name))
+        {
+            selected_kernels = k;
+            return 0;
+        }
+    }
+    
+    return -1;
+}
+
+void huffman_kernels_init(void)
+{
+    const char* name = getenv("HUFFMAN_KERNEL");
+    
+    if (NULL == name || 0 != huffman_kernels_select(name))
+        huffman_kernels_select(NULL);
+}
+
+const huffman_kernels_t* huffman_kernels(void)
+{
+    if (NULL == selected_kernels)
+        huffman_kernels_init();
+    
+    return selected_kernels;
+}
+
+uint32_t huffman_crc32c(uint32_t crc, const uint8_t* buf, size_t size)
+{
+    return huffman_kernels()->crc32c(crc, buf, size);
+}
+
+uint32_t huffman_crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t size_b)
+{
+    uint32_t x = (uint32_t) 1 << 31;
+    int k = 3;
+    
+    if (NULL == selected_kernels)
+        huffman_kernels_init();
+    
+    /* crc_a times x^(8 * size_b), by the binary digits of size_b. */
+    for (; size_b > 0; size_b >>= 1, k++)
+    {
+        if (size_b & 1)
+            x = crc32c_multiply(crc32c_x2n[k & 63], x);
+    }
+    
+    return crc32c_multiply(x, crc_a) ^ crc_b;
+}
@@ -0,0 +1,63 @@
+#ifndef ___huffman__dispatch_h___
+#define ___huffman__dispatch_h___
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "bitstream.h"
+
+#define HUFFMAN_CPU_BMI2    0x01
+#define HUFFMAN_CPU_AVX2    0x02
+#define HUFFMAN_CPU_SSE42   0x04
+#define HUFFMAN_CPU_CRC32   0x08    /* ARMv8 CRC32 extension */
+
+/*
+ * Hot loops with several implementations. One table is picked at startup
+ * from the features of the running CPU, so a single binary built for the
+ * baseline target still uses the wider instructions where they exist.
+ * HUFFMAN_KERNEL=<name> in the environment forces a table by name.
+ */
+struct huffman_kernels_s
+{
+    const char* name;
+    int required_features;
+    
+    /* Add the byte counts of buf to counts[256]. */
+    void (*histogram)(size_t* counts, const uint8_t* buf, size_t size);
+    
+    /* Decode count symbols through a (symbol << 4 | length) table. */
+    int (*decode)(
+        const uint16_t* table,
+        int bits,
+        bitreader_t* br,
+        uint8_t* out,
+        size_t count
+    );
+    
+    /* Continue a CRC32C (Castagnoli) over buf, see huffman_crc32c(). */
+    uint32_t (*crc32c)(uint32_t crc, const uint8_t* buf, size_t size);
+};
+
+typedef struct huffman_kernels_s huffman_kernels_t;
+
+int huffman_cpu_features(void);
+
+const huffman_kernels_t* huffman_kernels(void);
+
+const huffman_kernels_t* huffman_kernels_list(size_t* count);
+
+int huffman_kernels_select(const char* name);
+
+void huffman_kernels_init(void);
+
+/*
+ * CRC32C of buf appended to data whose CRC32C is crc, 0 to start. Runs
+ * on the SSE4.2 or ARMv8 crc32c instructions where the selected kernels
+ * have them, otherwise slicing-by-8 tables.
+ */
+uint32_t huffman_crc32c(uint32_t crc, const uint8_t* buf, size_t size);
+
+/* CRC32C of A followed by B from the CRC32C of each and B's length. */
+uint32_t huffman_crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t size_b);
+
+#endif
@@ -1,4 +1,8 @@
 #include "huffman.h"
+#include "dispatch.h"
+
+#include <string.h>
+#include <math.h>
 
 int chartab_item_init(chartab_item_t* item, int chval)
 {
@@ -83,6 +87,9 @@ size_t chartab_char_set_count(chartab_t* tab, int chval, size_t count)
 chartab_t* chartab_read_from_file(FILE* fp)
 {
     chartab_t* tab = NULL;
+    uint8_t buf[16 * 1024];
+    size_t n = 0;
+    
     if (NULL == fp)
         return NULL;
     
@@ -90,13 +97,264 @@ chartab_t* chartab_read_from_file(FILE* fp)
     if (NULL == tab)
         return NULL;
     
-    while (!feof(fp))
+    while (0 < (n = fread(buf, 1, sizeof(buf), fp)))
+        chartab_accumulate(tab, buf, n);
+    
+    return tab;
+}
+
+void chartab_clear(chartab_t* tab)
+{
+    size_t i = 0;
+    
+    if (NULL == tab || NULL == tab->items)
+        return;
+    
+    for (i = 0; i < tab->size; i++)
+        tab->items[i].count = 0;
+    
+    return;
+}
+
+size_t chartab_total(const chartab_t* tab)
+{
+    size_t i = 0, total = 0;
+    
+    if (NULL == tab || NULL == tab->items)
+        return 0;
+    
+    for (i = 0; i < tab->size; i++)
+        total += tab->items[i].count;
+    
+    return total;
+}
+
+int chartab_accumulate(chartab_t* tab, const uint8_t* buf, size_t size)
+{
+    size_t counts[HUFFMAN_ASCII_BYTE_CHARTAB_SIZE];
+    size_t i = 0;
+    
+    if (NULL == tab || NULL == tab->items || (NULL == buf && size > 0))
+        return -1;
+    
+    /* Tables narrower than a byte drop what they can not hold. */
+    if (tab->size < HUFFMAN_ASCII_BYTE_CHARTAB_SIZE)
     {
-        int c = fgetc(fp);
-        chartab_char_increase(tab, c);
+        for (i = 0; i < size; i++)
+            chartab_char_increase(tab, buf[i]);
+        
+        return 0;
     }
     
-    return tab;
+    memset(counts, 0, sizeof(counts));
+    huffman_kernels()->histogram(counts, buf, size);
+    for (i = 0; i < HUFFMAN_ASCII_BYTE_CHARTAB_SIZE; i++)
+        tab->items[i].count += counts[i];
+    
+    return 0;
+}
+
+int chartab_merge(chartab_t* dst, const chartab_t* src)
+{
+    size_t i = 0;
+    
+    if (NULL == dst || NULL == src || NULL == dst->items || NULL == src->items)
+        return -1;
+    
+    if (dst->size != src->size)
+        return -2;
+    
+    for (i = 0; i < dst->size; i++)
+        dst->items[i].count += src->items[i].count;
+    
+    return 0;
+}
+
+int chartab_subtract(chartab_t* dst, const chartab_t* src)
+{
+    size_t i = 0;
+    int retval = 0;
+    
+    if (NULL == dst || NULL == src || NULL == dst->items || NULL == src->items)
+        return -1;
+    
+    if (dst->size != src->size)
+        return -2;
+    
+    /* Clamp at zero, but tell the caller src was not a subset. */
+    for (i = 0; i < dst->size; i++)
+    {
+        if (dst->items[i].count >= src->items[i].count)
+            dst->items[i].count -= src->items[i].count;
+        else
+        {
+            dst->items[i].count = 0;
+            retval = -3;
+        }
+    }
+    
+    return retval;
+}
+
+int chartab_scale(chartab_t* tab, size_t num, size_t den)
+{
+    size_t i = 0;
+    
+    if (NULL == tab || NULL == tab->items)
+        return -1;
+    
+    if (0 == den)
+        return -2;
+    
+    /* Seen symbols stay seen so a table built from it still codes them. */
+    for (i = 0; i < tab->size; i++)
+    {
+        size_t count = tab->items[i].count;
+        if (0 == count)
+            continue;
+        
+        count = (size_t) ((double) count * (double) num / (double) den);
+        tab->items[i].count = count > 0 ? count : 1;
+    }
+    
+    return 0;
+}
+
+int chartab_normalize(chartab_t* tab, size_t total)
+{
+    size_t current = chartab_total(tab);
+    
+    if (NULL == tab || NULL == tab->items)
+        return -1;
+    
+    if (0 == current)
+        return 0;
+    
+    return chartab_scale(tab, total, current);
+}
+
+/*
+ * Total variation distance between the two distributions in 1/1000:
+ * 0 for identical shapes, 1000 for disjoint ones. Cheap enough to run
+ * on every block to decide whether an old table is still good.
+ */
+int chartab_drift(const chartab_t* tab, const chartab_t* ref)
+{
+    double total = 0.0, ref_total = 0.0, distance = 0.0;
+    size_t i = 0;
+    
+    if (NULL == tab || NULL == ref || NULL == tab->items || NULL == ref->items)
+        return -1;
+    
+    if (tab->size != ref->size)
+        return -2;
+    
+    total = (double) chartab_total(tab);
+    ref_total = (double) chartab_total(ref);
+    if (0.0 == total || 0.0 == ref_total)
+        return total == ref_total ? 0 : 1000;
+    
+    for (i = 0; i < tab->size; i++)
+    {
+        double d = (double) tab->items[i].count / total -
+            (double) ref->items[i].count / ref_total;
+        distance += d < 0.0 ? -d : d;
+    }
+    
+    return (int) (distance * 500.0 + 0.5);
+}
+
+/* Shannon bound of coding tab with any prefix code, in bits. */
+double chartab_entropy_bits(const chartab_t* tab)
+{
+    double total = 0.0, bits = 0.0;
+    size_t i = 0;
+    
+    if (NULL == tab || NULL == tab->items)
+        return 0.0;
+    
+    total = (double) chartab_total(tab);
+    for (i = 0; i < tab->size; i++)
+    {
+        double count = (double) tab->items[i].count;
+        if (count > 0.0)
+            bits -= count * log(count / total);
+    }
+    
+    return bits / log(2.0);
+}
+
+chartab_window_t* chartab_window_create(size_t blocks, size_t charset_size)
+{
+    chartab_window_t* win = NULL;
+    size_t i = 0;
+    
+    if (0 == blocks)
+        return NULL;
+    
+    win = (chartab_window_t*) malloc(sizeof(chartab_window_t));
+    if (NULL == win)
+        return NULL;
+    
+    win->blocks = blocks;
+    win->pos = 0;
+    win->tab = chartab_create(charset_size);
+    win->ring = (chartab_t**) calloc(blocks, sizeof(chartab_t*));
+    if (NULL == win->tab || NULL == win->ring)
+    {
+        chartab_window_free(win);
+        return NULL;
+    }
+    
+    for (i = 0; i < blocks; i++)
+    {
+        win->ring[i] = chartab_create(charset_size);
+        if (NULL == win->ring[i])
+        {
+            chartab_window_free(win);
+            return NULL;
+        }
+    }
+    
+    return win;
+}
+
+void chartab_window_free(chartab_window_t* win)
+{
+    size_t i = 0;
+    
+    if (NULL == win)
+        return;
+    
+    chartab_free(win->tab);
+    for (i = 0; NULL != win->ring && i < win->blocks; i++)
+        chartab_free(win->ring[i]);
+    
+    if (NULL != win->ring)
+        free(win->ring);
+    
+    free(win);
+    return;
+}
+
+/* Costs two passes over the alphabet, whatever the block size. */
+int chartab_window_push(chartab_window_t* win, const chartab_t* block)
+{
+    chartab_t* oldest = NULL;
+    
+    if (NULL == win || NULL == block)
+        return -1;
+    
+    if (block->size != win->tab->size)
+        return -2;
+    
+    oldest = win->ring[win->pos];
+    chartab_subtract(win->tab, oldest);
+    chartab_merge(win->tab, block);
+    chartab_clear(oldest);
+    chartab_merge(oldest, block);
+    win->pos = (win->pos + 1) % win->blocks;
+    return 0;
 }
 
 huffman_tree_node_t* huffman_tree_node_init(int chval, size_t count)
@@ -133,6 +391,17 @@ void huffman_tree_node_free(huffman_tree_node_t* node)
     return;
 }
 
+void huffman_tree_node_free_recursive(huffman_tree_node_t* node)
+{
+    if (NULL == node)
+        return;
+    
+    huffman_tree_node_free_recursive(node->lchild);
+    huffman_tree_node_free_recursive(node->rchild);
+    huffman_tree_node_free(node);
+    return;
+}
+
 huffman_tree_node_t* huffman_tree_node_combine(
     const huffman_tree_node_t* node1,
     const huffman_tree_node_t* node2
@@ -164,10 +433,10 @@ int huffman_tree_node_compare(
     /* node1->count == node2->count */
     if (-1 == node1->chval && node2->chval >= 0)
         return -1;
-
+    
     if (node1->chval >= 0 && -1 == node2->chval)
         return 1;
-
+    
     if (node1->chval < node2->chval)
         return 1;
     
@@ -203,10 +472,19 @@ huffman_tree_t* huffman_tree_init(size_t size)
 
 void huffman_tree_free(huffman_tree_t* tree)
 {
+    size_t i = 0;
+    
     if (NULL != tree)
     {
         if (NULL != tree->tab)
+        {
+            for (i = 0; i < tree->size; i++)
+                huffman_tree_node_free(tree->tab[i]);
+            
             free(tree->tab);
+        }
+        
+        huffman_tree_node_free_recursive(tree->root);
         
         free(tree);
     }
@@ -223,7 +501,7 @@ int huffman_tree_add_char(huffman_tree_t* tree, const chartab_item_t* item)
         return -1;
     
     chval = item->chval;
-    if (chval < 0 || tree->size < (size_t) chval)
+    if (chval < 0 || tree->size <= (size_t) chval)
         return -2;
     
     if (NULL == tree->tab)
@@ -246,6 +524,9 @@ huffman_tree_t* huffman_tree_create(const chartab_t* tab)
         return NULL;
     
     tree = huffman_tree_init(tab->size);
+    if (NULL == tree)
+        return NULL;
+    
     for (i = 0; i < tab->size; i++)
     {
         chartab_item_t* item = &tab->items[i];
@@ -326,7 +607,7 @@ int huffman_tree_sort_onepass(huffman_tree_node_t** nodes, size_t length)
             nodes[i] = nodes[j];
             nodes[j] = t;
         }
-        
+    
     }
     
     return 0;
@@ -382,6 +663,12 @@ int huffman_tree_build(huffman_tree_t* tree)
         return -1;
     
     ch_count = huffman_tree_nonzero_char_count(tree);
+    if (ch_count <= 0)
+        return -3;
+    
+    huffman_tree_node_free_recursive(tree->root);
+    tree->root = NULL;
+    
     tab = (huffman_tree_node_t**)
         malloc(ch_count * sizeof(huffman_tree_node_t*));
     
@@ -397,13 +684,28 @@ int huffman_tree_build(huffman_tree_t* tree)
         huffman_tree_node_t* node = tree->tab[i];
         if (NULL != node && node->count > 0)
         {
-            printf("create node [%d](%d, %zu)\n", j, node->chval, node->count);
-            tab[j++] = huffman_tree_node_init(node->chval, node->count);
+#ifdef HUFFMAN_DEBUG
+            printf("create node [%d](%d, %d)\n",
+                   j, node->chval, (int) node->count);
+#endif
+            tab[j] = huffman_tree_node_init(node->chval, node->count);
+            if (NULL == tab[j])
+            {
+                while (j > 0)
+                    huffman_tree_node_free(tab[--j]);
+                
+                free(tab);
+                return -2;
+            }
+            
+            j++;
         }
     }
     
+#ifdef HUFFMAN_DEBUG
     printf("First nodes\n");
     huffman_tree_nodes_print(tab, ch_count);
+#endif
     
     for (last_chars = ch_count; last_chars > 1; last_chars--)
     {
@@ -414,14 +716,17 @@ int huffman_tree_build(huffman_tree_t* tree)
         huffman_tree_node_t* new_last = NULL;
         
         huffman_tree_sort(tab, last_chars);
+#ifdef HUFFMAN_DEBUG
         printf("Sorted %d\n", last_chars);
         huffman_tree_nodes_print(tab, last_chars);
+#endif
         
         last_n1 = tab[last_i1];
         last_n2 = tab[last_i2];
         new_last = huffman_tree_node_init(-1, last_n1->count + last_n2->count);
         if (NULL == new_last)
         {
+            retval = -2;
             break;
         }
         
@@ -430,9 +735,19 @@ int huffman_tree_build(huffman_tree_t* tree)
         tab[last_i2] = new_last;
     }
     
+#ifdef HUFFMAN_DEBUG
     printf("Final\n");
     huffman_tree_nodes_print(tab, last_chars);
-    tree->root = tab[0];
+#endif
+    if (0 != retval)
+    {
+        for (i = 0; i < last_chars; i++)
+            huffman_tree_node_free_recursive(tab[i]);
+    }
+    else
+        tree->root = tab[0];
+    
+    free(tab);
     return retval;
 }
 
@@ -452,7 +767,7 @@ int huffman_tree_show_code_recursive(
         
         if (isprint(node->chval))
             ch = (char) node->chval;
-
+        
         bincode_get_string(code, code_str, bufsize);
         printf("(%d)'%c' [%d]: %s\n",
                (int) node->chval,
@@ -495,3 +810,548 @@ int huffman_tree_show_code(huffman_tree_t* tree)
     return 0;
 }
 
+huffman_codetab_t* huffman_codetab_create(size_t size)
+{
+    huffman_codetab_t* ct = (huffman_codetab_t*)
+        malloc(sizeof(huffman_codetab_t));
+    
+    if (NULL == ct)
+        return NULL;
+    
+    ct->size = size;
+    ct->max_length = 0;
+    ct->lengths = (uint8_t*) malloc(size * sizeof(uint8_t));
+    ct->codes = (uint32_t*) malloc(size * sizeof(uint32_t));
+    if (NULL == ct->lengths || NULL == ct->codes)
+    {
+        huffman_codetab_free(ct);
+        return NULL;
+    }
+    
+    huffman_codetab_clear(ct);
+    return ct;
+}
+
+void huffman_codetab_free(huffman_codetab_t* ct)
+{
+    if (NULL == ct)
+        return;
+    
+    if (NULL != ct->lengths)
+        free(ct->lengths);
+    
+    if (NULL != ct->codes)
+        free(ct->codes);
+    
+    free(ct);
+    return;
+}
+
+void huffman_codetab_clear(huffman_codetab_t* ct)
+{
+    if (NULL == ct || NULL == ct->lengths || NULL == ct->codes)
+        return;
+    
+    memset(ct->lengths, 0, ct->size * sizeof(uint8_t));
+    memset(ct->codes, 0, ct->size * sizeof(uint32_t));
+    ct->max_length = 0;
+    return;
+}
+
+static void huffman_tree_code_lengths_recursive(
+    huffman_tree_node_t* node,
+    int depth,
+    huffman_codetab_t* ct
+)
+{
+    if (NULL == node)
+        return;
+    
+    if (NULL == node->lchild && NULL == node->rchild)
+    {
+        if (node->chval >= 0 && (size_t) node->chval < ct->size)
+        {
+            /* Clamp here, huffman_codetab_limit_lengths fixes Kraft sum. */
+            if (depth > 255)
+                depth = 255;
+            
+            /* A lone symbol still needs one bit. */
+            ct->lengths[node->chval] = (uint8_t) (depth > 0 ? depth : 1);
+        }
+        return;
+    }
+    
+    huffman_tree_code_lengths_recursive(node->lchild, depth + 1, ct);
+    huffman_tree_code_lengths_recursive(node->rchild, depth + 1, ct);
+    return;
+}
+
+int huffman_tree_code_lengths(huffman_tree_t* tree, huffman_codetab_t* ct)
+{
+    size_t i = 0;
+    
+    if (NULL == tree || NULL == ct)
+        return -1;
+    
+    if (NULL == tree->root)
+        return -2;
+    
+    huffman_codetab_clear(ct);
+    huffman_tree_code_lengths_recursive(tree->root, 0, ct);
+    
+    for (i = 0; i < ct->size; i++)
+    {
+        if (ct->lengths[i] > ct->max_length)
+            ct->max_length = ct->lengths[i];
+    }
+    
+    return 0;
+}
+
+/* Most frequent first, ties broken by symbol value. */
+static int chartab_item_compare_desc(const void* p1, const void* p2)
+{
+    const chartab_item_t* item1 = (const chartab_item_t*) p1;
+    const chartab_item_t* item2 = (const chartab_item_t*) p2;
+    
+    if (item1->count > item2->count)
+        return -1;
+    
+    if (item1->count < item2->count)
+        return 1;
+    
+    return item1->chval - item2->chval;
+}
+
+int huffman_codetab_limit_lengths(
+    huffman_codetab_t* ct,
+    const chartab_t* tab,
+    int max_length
+)
+{
+    size_t length_count[HUFFMAN_MAX_CODE_LENGTH + 1];
+    chartab_item_t* items = NULL;
+    size_t i = 0, n = 0;
+    uint32_t kraft = 0;
+    int len = 0;
+    
+    if (NULL == ct || NULL == tab || NULL == tab->items)
+        return -1;
+    
+    if (max_length < 1 || max_length > HUFFMAN_MAX_CODE_LENGTH)
+        return -2;
+    
+    if (ct->max_length <= max_length)
+        return 0;
+    
+    /* Count lengths with everything too long cut down to max_length. */
+    memset(length_count, 0, sizeof(length_count));
+    for (i = 0; i < ct->size; i++)
+    {
+        len = ct->lengths[i];
+        if (0 == len)
+            continue;
+        
+        if (len > max_length)
+            len = max_length;
+        
+        length_count[len] += 1;
+        kraft += (uint32_t) 1 << (max_length - len);
+        n += 1;
+    }
+    
+    if (n > ((size_t) 1 << max_length))
+        return -3;
+    
+    /*
+     * Cutting broke the Kraft inequality. Push the deepest codes that are
+     * still short enough one level down until the code is complete again;
+     * each move frees 2^(max_length - len - 1) units.
+     */
+    while (kraft > ((uint32_t) 1 << max_length))
+    {
+        for (len = max_length - 1; len > 0; len--)
+        {
+            if (length_count[len] > 0)
+                break;
+        }
+        
+        length_count[len] -= 1;
+        length_count[len + 1] += 1;
+        kraft -= (uint32_t) 1 << (max_length - len - 1);
+    }
+    
+    /* Hand the shortest lengths back to the most frequent symbols. */
+    items = (chartab_item_t*) malloc(n * sizeof(chartab_item_t));
+    if (NULL == items)
+        return -4;
+    
+    n = 0;
+    for (i = 0; i < ct->size; i++)
+    {
+        if (0 == ct->lengths[i])
+            continue;
+        
+        items[n].chval = (int) i;
+        items[n].count = i < tab->size ? tab->items[i].count : 0;
+        n += 1;
+    }
+    
+    qsort(items, n, sizeof(chartab_item_t), chartab_item_compare_desc);
+    
+    i = 0;
+    for (len = 1; len <= max_length; len++)
+    {
+        size_t k = 0;
+        for (k = 0; k < length_count[len]; k++)
+            ct->lengths[items[i++].chval] = (uint8_t) len;
+    }
+    
+    ct->max_length = max_length;
+    free(items);
+    return 0;
+}
+
+/*
+ * LSD radix sort of keys by byte, ping-ponging through tmp. Bytes that are
+ * the same in every key are skipped, so the few significant bytes of real
+ * counts take two or three passes.
+ */
+static void huffman_radix_sort(uint64_t* keys, uint64_t* tmp, size_t n)
+{
+    size_t bucket[256];
+    uint64_t* src = keys;
+    uint64_t* dst = tmp;
+    uint64_t* swap = NULL;
+    uint64_t any = 0, all = ~(uint64_t) 0;
+    size_t i = 0, sum = 0, count = 0;
+    int shift = 0;
+    
+    for (i = 0; i < n; i++)
+    {
+        any |= keys[i];
+        all &= keys[i];
+    }
+    
+    for (shift = 0; shift < 64; shift += 8)
+    {
+        if (0 == (((any ^ all) >> shift) & 0xff))
+            continue;
+        
+        memset(bucket, 0, sizeof(bucket));
+        for (i = 0; i < n; i++)
+            bucket[(src[i] >> shift) & 0xff] += 1;
+        
+        sum = 0;
+        for (i = 0; i < 256; i++)
+        {
+            count = bucket[i];
+            bucket[i] = sum;
+            sum += count;
+        }
+        
+        for (i = 0; i < n; i++)
+            dst[bucket[(src[i] >> shift) & 0xff]++] = src[i];
+        
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+    
+    if (src != keys)
+        memcpy(keys, src, n * sizeof(uint64_t));
+}
+
+/*
+ * Moffat and Katajainen's in-place minimum-redundancy code. On entry a
+ * holds n >= 2 weights in ascending order, on return the code length of
+ * each, which come out non-increasing. The first pass merges leaves and
+ * internal nodes left to right, leaving parent indices behind; the second
+ * turns parent indices into internal node depths; the third hands out leaf
+ * depths from the deepest level up.
+ */
+static void huffman_minimum_redundancy(uint64_t* a, long n)
+{
+    long root = 0, leaf = 2, next = 0;
+    long avail = 1, used = 0;
+    uint64_t depth = 0;
+    
+    a[0] += a[1];
+    for (next = 1; next < n - 1; next++)
+    {
+        if (leaf >= n || a[root] < a[leaf])
+        {
+            a[next] = a[root];
+            a[root++] = (uint64_t) next;
+        }
+        else
+            a[next] = a[leaf++];
+        
+        if (leaf >= n || (root < next && a[root] < a[leaf]))
+        {
+            a[next] += a[root];
+            a[root++] = (uint64_t) next;
+        }
+        else
+            a[next] += a[leaf++];
+    }
+    
+    a[n - 2] = 0;
+    for (next = n - 3; next >= 0; next--)
+        a[next] = a[a[next]] + 1;
+    
+    root = n - 2;
+    next = n - 1;
+    while (avail > 0)
+    {
+        while (root >= 0 && a[root] == depth)
+        {
+            used += 1;
+            root -= 1;
+        }
+        
+        while (avail > used)
+        {
+            a[next--] = depth;
+            avail -= 1;
+        }
+        
+        avail = 2 * used;
+        depth += 1;
+        used = 0;
+    }
+}
+
+int huffman_codetab_compute_lengths(
+    huffman_codetab_t* ct,
+    const chartab_t* tab,
+    int max_length
+)
+{
+    uint64_t keys[HUFFMAN_MAX_ALPHABET_SIZE];
+    uint64_t lengths[HUFFMAN_MAX_ALPHABET_SIZE];
+    size_t length_count[HUFFMAN_MAX_CODE_LENGTH + 1];
+    uint64_t mask = 0;
+    uint32_t kraft = 0;
+    size_t i = 0, n = 0, k = 0;
+    int shift = 0, len = 0;
+    
+    if (NULL == ct || NULL == tab || NULL == tab->items || ct->size < tab->size)
+        return -1;
+    
+    if (max_length < 1 || max_length > HUFFMAN_MAX_CODE_LENGTH)
+        return -1;
+    
+    if (tab->size > HUFFMAN_MAX_ALPHABET_SIZE)
+        return -2;
+    
+    /* Symbol in the low bits, so one sort orders by count, then symbol. */
+    while (((size_t) 1 << shift) < tab->size)
+        shift += 1;
+    
+    mask = ((uint64_t) 1 << shift) - 1;
+    huffman_codetab_clear(ct);
+    for (i = 0; i < tab->size; i++)
+    {
+        uint64_t count = tab->items[i].count;
+        
+        if (0 == count)
+            continue;
+        
+        if (count > (~(uint64_t) 0 >> shift))
+            return -2;
+        
+        keys[n++] = count << shift | i;
+    }
+    
+    if (0 == n)
+        return 0;
+    
+    if (n > ((size_t) 1 << max_length))
+        return -3;
+    
+    if (1 == n)
+    {
+        ct->lengths[keys[0] & mask] = 1;
+        ct->max_length = 1;
+        return 0;
+    }
+    
+    huffman_radix_sort(keys, lengths, n);
+    for (i = 0; i < n; i++)
+        lengths[i] = keys[i] >> shift;
+    
+    huffman_minimum_redundancy(lengths, (long) n);
+    
+    /*
+     * Same repair as huffman_codetab_limit_lengths, but the symbols are
+     * already in frequency order so the lengths go straight back out.
+     */
+    memset(length_count, 0, sizeof(length_count));
+    for (i = 0; i < n; i++)
+    {
+        len = lengths[i] > (uint64_t) max_length ?
+            max_length : (int) lengths[i];
+        length_count[len] += 1;
+        kraft += (uint32_t) 1 << (max_length - len);
+    }
+    
+    while (kraft > ((uint32_t) 1 << max_length))
+    {
+        for (len = max_length - 1; len > 0; len--)
+        {
+            if (length_count[len] > 0)
+                break;
+        }
+        
+        length_count[len] -= 1;
+        length_count[len + 1] += 1;
+        kraft -= (uint32_t) 1 << (max_length - len - 1);
+    }
+    
+    i = n;
+    for (len = 1; len <= max_length; len++)
+    {
+        for (k = 0; k < length_count[len]; k++)
+            ct->lengths[keys[--i] & mask] = (uint8_t) len;
+        
+        if (length_count[len] > 0)
+            ct->max_length = len;
+    }
+    
+    return 0;
+}
+
+int huffman_codetab_assign_codes(huffman_codetab_t* ct)
+{
+    uint32_t length_count[HUFFMAN_MAX_CODE_LENGTH + 1];
+    uint32_t next_code[HUFFMAN_MAX_CODE_LENGTH + 1];
+    uint32_t code = 0;
+    size_t i = 0;
+    int len = 0;
+    
+    if (NULL == ct || NULL == ct->lengths || NULL == ct->codes)
+        return -1;
+    
+    memset(length_count, 0, sizeof(length_count));
+    ct->max_length = 0;
+    for (i = 0; i < ct->size; i++)
+    {
+        len = ct->lengths[i];
+        if (len > HUFFMAN_MAX_CODE_LENGTH)
+            return -2;
+        
+        length_count[len] += 1;
+        if (len > ct->max_length)
+            ct->max_length = len;
+    }
+    
+    length_count[0] = 0;
+    for (len = 1; len <= HUFFMAN_MAX_CODE_LENGTH; len++)
+    {
+        code = (code + length_count[len - 1]) << 1;
+        next_code[len] = code;
+    }
+    
+    /* Oversubscribed lengths can not come from a prefix code. */
+    if (ct->max_length > 0 &&
+        next_code[ct->max_length] + length_count[ct->max_length] >
+            ((uint32_t) 1 << ct->max_length))
+        return -3;
+    
+    for (i = 0; i < ct->size; i++)
+    {
+        len = ct->lengths[i];
+        ct->codes[i] = len > 0 ? next_code[len]++ : 0;
+    }
+    
+    return 0;
+}
+
+/*
+ * Bits needed to code tab with ct, or (size_t) -1 when tab has a symbol
+ * ct has no code for.
+ */
+size_t huffman_codetab_cost(
+    const huffman_codetab_t* ct,
+    const chartab_t* tab
+)
+{
+    size_t i = 0, bits = 0;
+    
+    if (NULL == ct || NULL == tab || NULL == tab->items)
+        return (size_t) -1;
+    
+    for (i = 0; i < tab->size; i++)
+    {
+        size_t count = tab->items[i].count;
+        if (0 == count)
+            continue;
+        
+        if (i >= ct->size || 0 == ct->lengths[i])
+            return (size_t) -1;
+        
+        bits += count * ct->lengths[i];
+    }
+    
+    return bits;
+}
+
+int huffman_codetab_build(
+    huffman_codetab_t* ct,
+    const chartab_t* tab,
+    int max_length
+)
+{
+    huffman_tree_t* tree = NULL;
+    size_t i = 0;
+    int nonzero = 0;
+    int ret = 0;
+    
+    if (NULL == ct || NULL == tab || NULL == tab->items)
+        return -1;
+    
+    ret = huffman_codetab_compute_lengths(ct, tab, max_length);
+    if (-2 != ret)
+    {
+        if (0 != ret)
+            return -4;
+        
+        if (0 != huffman_codetab_assign_codes(ct))
+            return -5;
+        
+        return 0;
+    }
+    
+    /* Alphabets too large for the stack arrays go through a tree. */
+    huffman_codetab_clear(ct);
+    for (i = 0; i < tab->size; i++)
+    {
+        if (tab->items[i].count > 0)
+            nonzero += 1;
+    }
+    
+    if (0 == nonzero)
+        return 0;
+    
+    tree = huffman_tree_create(tab);
+    if (NULL == tree)
+        return -2;
+    
+    ret = huffman_tree_build(tree);
+    if (0 == ret)
+        ret = huffman_tree_code_lengths(tree, ct);
+    
+    huffman_tree_free(tree);
+    if (0 != ret)
+        return -3;
+    
+    if (0 != huffman_codetab_limit_lengths(ct, tab, max_length))
+        return -4;
+    
+    if (0 != huffman_codetab_assign_codes(ct))
+        return -5;
+    
+    return 0;
+}
+
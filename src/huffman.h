@@ -4,11 +4,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <stdint.h>
 
 #include "bitstream.h"
 
 #define HUFFMAN_ASCII_BYTE_CHARTAB_SIZE 256
 
+/* Longest code a canonical table may hold; 15 fits a length in a nibble. */
+#define HUFFMAN_MAX_CODE_LENGTH 15
+
+/* Largest alphabet whose code lengths are computed without a tree. */
+#define HUFFMAN_MAX_ALPHABET_SIZE 1024
+
 struct chartab_item_s
 {
     int chval;
@@ -37,6 +44,45 @@ size_t chartab_char_set_count(chartab_t* tab, int chval, size_t count);
 
 chartab_t* chartab_read_from_file(FILE* fp);
 
+void chartab_clear(chartab_t* tab);
+
+size_t chartab_total(const chartab_t* tab);
+
+int chartab_accumulate(chartab_t* tab, const uint8_t* buf, size_t size);
+
+int chartab_merge(chartab_t* dst, const chartab_t* src);
+
+int chartab_subtract(chartab_t* dst, const chartab_t* src);
+
+int chartab_scale(chartab_t* tab, size_t num, size_t den);
+
+int chartab_normalize(chartab_t* tab, size_t total);
+
+int chartab_drift(const chartab_t* tab, const chartab_t* ref);
+
+double chartab_entropy_bits(const chartab_t* tab);
+
+/*
+ * Distribution of the last blocks pushed through the window: tab is the
+ * sum of the per-block counts kept in the ring, the oldest of which is
+ * subtracted when a new one comes in.
+ */
+struct chartab_window_s
+{
+    chartab_t* tab;
+    chartab_t** ring;
+    size_t blocks;
+    size_t pos;
+};
+
+typedef struct chartab_window_s chartab_window_t;
+
+chartab_window_t* chartab_window_create(size_t blocks, size_t charset_size);
+
+void chartab_window_free(chartab_window_t* win);
+
+int chartab_window_push(chartab_window_t* win, const chartab_t* block);
+
 typedef struct huffman_tree_node_s huffman_tree_node_t;
 
 struct huffman_tree_node_s
@@ -63,6 +109,8 @@ huffman_tree_node_t* huffman_tree_node_create(const chartab_item_t* item);
 
 void huffman_tree_node_free(huffman_tree_node_t* node);
 
+void huffman_tree_node_free_recursive(huffman_tree_node_t* node);
+
 huffman_tree_node_t* huffman_tree_node_combine(
     const huffman_tree_node_t* node1,
     const huffman_tree_node_t* node2
@@ -98,6 +146,58 @@ int huffman_tree_show_code_recursive(
 
 int huffman_tree_show_code(huffman_tree_t* tree);
 
+/*
+ * Canonical code table: one code length per symbol, codes are assigned
+ * from the lengths alone so only the lengths need to be stored.
+ */
+struct huffman_codetab_s
+{
+    size_t size;
+    int max_length;
+    uint8_t* lengths;
+    uint32_t* codes;
+};
+
+typedef struct huffman_codetab_s huffman_codetab_t;
+
+huffman_codetab_t* huffman_codetab_create(size_t size);
+
+void huffman_codetab_free(huffman_codetab_t* ct);
+
+void huffman_codetab_clear(huffman_codetab_t* ct);
+
+int huffman_tree_code_lengths(huffman_tree_t* tree, huffman_codetab_t* ct);
 
+int huffman_codetab_limit_lengths(
+    huffman_codetab_t* ct,
+    const chartab_t* tab,
+    int max_length
+);
+
+/*
+ * Length-limited code lengths for tab straight into ct->lengths, without
+ * building a tree: the nonzero counts are radix sorted into one integer
+ * array which is turned into code lengths in place (Moffat and Katajainen,
+ * "In-Place Calculation of Minimum-Redundancy Codes"). Uses no heap and
+ * returns -2 when tab is larger than HUFFMAN_MAX_ALPHABET_SIZE.
+ */
+int huffman_codetab_compute_lengths(
+    huffman_codetab_t* ct,
+    const chartab_t* tab,
+    int max_length
+);
+
+int huffman_codetab_assign_codes(huffman_codetab_t* ct);
+
+size_t huffman_codetab_cost(
+    const huffman_codetab_t* ct,
+    const chartab_t* tab
+);
+
+int huffman_codetab_build(
+    huffman_codetab_t* ct,
+    const chartab_t* tab,
+    int max_length
+);
 
 #endif
@@ -0,0 +1,549 @@
+#ifndef ___huffman__huffman_hpp___
+#define ___huffman__huffman_hpp___
+
+/*
+ * Header-only C++17 interface over the C library.
+ *
+ * Every C object is owned by exactly one wrapper and freed by it. Encoder
+ * and decoder contexts are move-only and keep their tables between calls,
+ * so coding buffer after buffer with one context allocates nothing after
+ * it is constructed. Failures throw huffman::error carrying the negative
+ * code the C function returned.
+ *
+ * basic_encoder<MaxLength> and basic_decoder<MaxLength, LookupBits> put
+ * the code length limit and the lookup width into the type. Their inner
+ * loops then work with constant shifts, a fixed table size and a known
+ * number of symbols per refill. They read and write the block sequence of
+ * huffman_compress(), so either side may be the C one.
+ */
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+#include "huffman.h"
+#include "codec.h"
+}
+
+namespace huffman {
+
+class error : public std::runtime_error
+{
+public:
+    error(const char* what, int code)
+        : std::runtime_error(std::string(what) + " (" +
+                             std::to_string(code) + ")"),
+          code_(code)
+    {
+    }
+
+    int code() const noexcept { return code_; }
+
+private:
+    int code_;
+};
+
+namespace detail {
+
+inline void check(int ret, const char* what)
+{
+    if (0 != ret)
+        throw error(what, ret);
+}
+
+template <class T>
+T* check_alloc(T* p, const char* what)
+{
+    if (nullptr == p)
+        throw error(what, -7);
+
+    return p;
+}
+
+struct chartab_deleter
+{
+    void operator()(chartab_t* p) const noexcept { chartab_free(p); }
+};
+
+struct codetab_deleter
+{
+    void operator()(huffman_codetab_t* p) const noexcept
+    {
+        huffman_codetab_free(p);
+    }
+};
+
+} /* namespace detail */
+
+/*
+ * Non-owning view of contiguous elements, the subset of C++20 std::span
+ * this interface needs. Converts from arrays, containers with data() and
+ * size(), and span<T> to span<const T>.
+ */
+template <class T>
+class span
+{
+public:
+    using element_type = T;
+    using value_type = typename std::remove_cv<T>::type;
+    using size_type = std::size_t;
+    using iterator = T*;
+
+    constexpr span() noexcept : data_(nullptr), size_(0) {}
+
+    constexpr span(T* data, size_type size) noexcept
+        : data_(data), size_(size)
+    {
+    }
+
+    template <std::size_t N>
+    constexpr span(T (&array)[N]) noexcept : data_(array), size_(N) {}
+
+    template <class C,
+              class = typename std::enable_if<
+                  std::is_convertible<
+                      decltype(std::declval<C&>().data()), T*>::value>::type>
+    constexpr span(C& container) noexcept
+        : data_(container.data()), size_(container.size())
+    {
+    }
+
+    template <class U,
+              class = typename std::enable_if<
+                  std::is_convertible<U*, T*>::value>::type>
+    constexpr span(const span<U>& other) noexcept
+        : data_(other.data()), size_(other.size())
+    {
+    }
+
+    constexpr T* data() const noexcept { return data_; }
+    constexpr size_type size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return 0 == size_; }
+    constexpr T* begin() const noexcept { return data_; }
+    constexpr T* end() const noexcept { return data_ + size_; }
+    constexpr T& operator[](size_type i) const noexcept { return data_[i]; }
+
+    constexpr span first(size_type n) const noexcept
+    {
+        return span(data_, n);
+    }
+
+    constexpr span subspan(size_type offset) const noexcept
+    {
+        return span(data_ + offset, size_ - offset);
+    }
+
+private:
+    T* data_;
+    size_type size_;
+};
+
+using bytes = span<uint8_t>;
+using const_bytes = span<const uint8_t>;
+
+/* Owning chartab_t. */
+class chartab
+{
+public:
+    explicit chartab(std::size_t size = HUFFMAN_ASCII_BYTE_CHARTAB_SIZE)
+        : tab_(detail::check_alloc(chartab_create(size), "chartab_create"))
+    {
+    }
+
+    void clear() noexcept { chartab_clear(tab_.get()); }
+
+    void accumulate(const_bytes buf) noexcept
+    {
+        chartab_accumulate(tab_.get(), buf.data(), buf.size());
+    }
+
+    std::size_t total() const noexcept { return chartab_total(tab_.get()); }
+
+    double entropy_bits() const noexcept
+    {
+        return chartab_entropy_bits(tab_.get());
+    }
+
+    std::size_t operator[](std::size_t ch) const noexcept
+    {
+        return tab_->items[ch].count;
+    }
+
+    chartab_t* get() noexcept { return tab_.get(); }
+    const chartab_t* get() const noexcept { return tab_.get(); }
+
+private:
+    std::unique_ptr<chartab_t, detail::chartab_deleter> tab_;
+};
+
+/* Owning huffman_codetab_t, canonical codes of at most max_length bits. */
+class codetab
+{
+public:
+    explicit codetab(std::size_t size = HUFFMAN_ASCII_BYTE_CHARTAB_SIZE)
+        : ct_(detail::check_alloc(huffman_codetab_create(size),
+                                  "huffman_codetab_create"))
+    {
+    }
+
+    void build(const chartab& tab, int max_length)
+    {
+        detail::check(huffman_codetab_build(ct_.get(), tab.get(), max_length),
+                      "huffman_codetab_build");
+    }
+
+    std::size_t read(const uint8_t* table)
+    {
+        detail::check(huffman_table_read(ct_.get(), table),
+                      "huffman_table_read");
+        return HUFFMAN_TABLE_BYTES(ct_->size);
+    }
+
+    std::size_t write(uint8_t* table) const noexcept
+    {
+        return huffman_table_write(ct_.get(), table);
+    }
+
+    std::size_t cost(const chartab& tab) const noexcept
+    {
+        return huffman_codetab_cost(ct_.get(), tab.get());
+    }
+
+    std::size_t size() const noexcept { return ct_->size; }
+    int max_length() const noexcept { return ct_->max_length; }
+    int length(std::size_t ch) const noexcept { return ct_->lengths[ch]; }
+    uint32_t code(std::size_t ch) const noexcept { return ct_->codes[ch]; }
+
+    huffman_codetab_t* get() noexcept { return ct_.get(); }
+    const huffman_codetab_t* get() const noexcept { return ct_.get(); }
+
+private:
+    std::unique_ptr<huffman_codetab_t, detail::codetab_deleter> ct_;
+};
+
+/* Sizes of huffman_compress() output, shared by both sides. */
+inline std::size_t compress_bound(std::size_t raw_size) noexcept
+{
+    return huffman_compress_bound(raw_size);
+}
+
+inline std::size_t decompressed_size(const_bytes in)
+{
+    std::size_t raw = 0;
+
+    detail::check(huffman_decompressed_size(in.data(), in.size(), &raw),
+                  "huffman_decompressed_size");
+    return raw;
+}
+
+template <int MaxLength = HUFFMAN_MAX_CODE_LENGTH>
+class basic_encoder
+{
+    static_assert(MaxLength >= 8 && MaxLength <= HUFFMAN_MAX_CODE_LENGTH,
+                  "256 symbols need 8 bits, tables store at most 15");
+
+public:
+    static constexpr int max_length = MaxLength;
+
+    basic_encoder() = default;
+    basic_encoder(basic_encoder&&) noexcept = default;
+    basic_encoder& operator=(basic_encoder&&) noexcept = default;
+    basic_encoder(const basic_encoder&) = delete;
+    basic_encoder& operator=(const basic_encoder&) = delete;
+
+    /* Codes in into out, returns the part of out that was written. */
+    bytes compress(const_bytes in, bytes out)
+    {
+        std::size_t done = 0, pos = 0;
+
+        while (done < in.size())
+        {
+            std::size_t n = in.size() - done;
+            std::size_t header_size = HUFFMAN_BLOCK_HEADER_SIZE +
+                HUFFMAN_TABLE_BYTES(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE);
+            std::size_t payload = 0;
+
+            if (n > HUFFMAN_DEFAULT_BLOCK_SIZE)
+                n = HUFFMAN_DEFAULT_BLOCK_SIZE;
+
+            tab_.clear();
+            tab_.accumulate(const_bytes(in.data() + done, n));
+            ct_.build(tab_, MaxLength);
+
+            if (out.size() - pos < header_size + HUFFMAN_BLOCK_HEADER_SIZE)
+                throw error("basic_encoder::compress", -3);
+
+            payload = encode(in.data() + done, n,
+                             out.data() + pos + header_size,
+                             out.size() - pos - header_size -
+                                 HUFFMAN_BLOCK_HEADER_SIZE);
+
+            huffman_put_le(out.data() + pos, n, 4);
+            huffman_put_le(out.data() + pos + 4, payload, 4);
+            out[pos + 8] = HUFFMAN_BLOCK_TABLE_INLINE;
+            ct_.write(out.data() + pos + HUFFMAN_BLOCK_HEADER_SIZE);
+
+            pos += header_size + payload;
+            done += n;
+        }
+
+        if (out.size() - pos < HUFFMAN_BLOCK_HEADER_SIZE)
+            throw error("basic_encoder::compress", -3);
+
+        std::memset(out.data() + pos, 0, HUFFMAN_BLOCK_HEADER_SIZE);
+        return out.first(pos + HUFFMAN_BLOCK_HEADER_SIZE);
+    }
+
+private:
+    /*
+     * After a spill fewer than 8 bits are pending, so this many codes fit
+     * into the 64-bit accumulator before the next one is needed.
+     */
+    static constexpr int per_spill = (64 - 7) / MaxLength;
+
+    std::size_t encode(const uint8_t* in, std::size_t n,
+                       uint8_t* out, std::size_t cap)
+    {
+        const uint8_t* lengths = ct_.get()->lengths;
+        const uint32_t* codes = ct_.get()->codes;
+        bitwriter_t bw;
+        std::size_t i = 0;
+
+        bitwriter_init(&bw, out, cap);
+        for (; i + per_spill <= n; i += per_spill)
+        {
+            for (int k = 0; k < per_spill; k++)
+            {
+                int len = lengths[in[i + k]];
+                bw.acc = (bw.acc << len) | codes[in[i + k]];
+                bw.count += len;
+            }
+
+            /* Whole bytes out in one big endian store while there is room. */
+            if (bw.pos + 8 <= bw.size)
+            {
+                uint64_t word = bw.acc << (64 - bw.count);
+                int nbytes = bw.count >> 3;
+
+                for (int k = 0; k < 8; k++)
+                    bw.data[bw.pos + k] =
+                        static_cast<uint8_t>(word >> (56 - 8 * k));
+
+                bw.pos += static_cast<std::size_t>(nbytes);
+                bw.count -= nbytes * 8;
+            }
+            else
+                bitwriter_spill(&bw);
+        }
+
+        for (; i < n; i++)
+            BITWRITER_PUT(&bw, codes[in[i]], lengths[in[i]]);
+
+        if (0 != bitwriter_flush(&bw))
+            throw error("basic_encoder::compress", -3);
+
+        return bw.pos;
+    }
+
+    chartab tab_;
+    codetab ct_;
+};
+
+template <int MaxLength = HUFFMAN_MAX_CODE_LENGTH, int LookupBits = 11>
+class basic_decoder
+{
+    static_assert(MaxLength >= 8 && MaxLength <= HUFFMAN_MAX_CODE_LENGTH,
+                  "256 symbols need 8 bits, tables store at most 15");
+    static_assert(LookupBits >= 1 && LookupBits <= MaxLength,
+                  "lookup wider than the longest code only wastes memory");
+
+public:
+    static constexpr int max_length = MaxLength;
+    static constexpr int lookup_bits = LookupBits;
+    static constexpr std::size_t table_size = std::size_t(1) << LookupBits;
+
+    basic_decoder()
+        : table_(new uint16_t[table_size]),
+          sorted_(new uint8_t[HUFFMAN_ASCII_BYTE_CHARTAB_SIZE])
+    {
+    }
+
+    basic_decoder(basic_decoder&&) noexcept = default;
+    basic_decoder& operator=(basic_decoder&&) noexcept = default;
+    basic_decoder(const basic_decoder&) = delete;
+    basic_decoder& operator=(const basic_decoder&) = delete;
+
+    /* Decodes in into out, returns the part of out that was written. */
+    bytes decompress(const_bytes in, bytes out)
+    {
+        std::size_t pos = 0, done = 0;
+
+        for (;;)
+        {
+            if (in.size() - pos < HUFFMAN_BLOCK_HEADER_SIZE)
+                throw error("basic_decoder::decompress", -8);
+
+            const uint8_t* header = in.data() + pos;
+            std::size_t n = static_cast<std::size_t>(
+                huffman_get_le(header, 4));
+            std::size_t payload = static_cast<std::size_t>(
+                huffman_get_le(header + 4, 4));
+            int kind = header[8] & 0x0f;
+
+            pos += HUFFMAN_BLOCK_HEADER_SIZE;
+            if (0 == n)
+                break;
+
+            if (n > out.size() - done || payload > huffman_encode_bound(n))
+                throw error("basic_decoder::decompress", -9);
+
+            /* Tables this type can decode only come inline. */
+            if (HUFFMAN_BLOCK_TABLE_INLINE != kind)
+                throw error("basic_decoder::decompress", -9);
+
+            if (in.size() - pos < HUFFMAN_TABLE_BYTES(ct_.size()))
+                throw error("basic_decoder::decompress", -8);
+
+            pos += ct_.read(in.data() + pos);
+            build();
+
+            if (in.size() - pos < payload)
+                throw error("basic_decoder::decompress", -8);
+
+            decode(in.data() + pos, payload, out.data() + done, n);
+            pos += payload;
+            done += n;
+        }
+
+        return out.first(done);
+    }
+
+private:
+    /* A refill leaves at least 56 bits, enough for this many codes. */
+    static constexpr int per_refill = 56 / MaxLength;
+
+    /*
+     * Codes up to LookupBits long resolve in table_, entries are
+     * (symbol << 4 | length). Longer ones leave a zero entry and are
+     * found from the first code of each length, canonical codes of one
+     * length being consecutive.
+     */
+    void build()
+    {
+        const huffman_codetab_t* ct = ct_.get();
+
+        if (ct->max_length > MaxLength)
+            throw error("basic_decoder::decompress", -9);
+
+        std::memset(table_.get(), 0, table_size * sizeof(uint16_t));
+        first_.fill(0xffffffffu);
+        count_.fill(0);
+        for (std::size_t i = 0; i < ct->size; i++)
+        {
+            int len = ct->lengths[i];
+            if (0 == len)
+                continue;
+
+            count_[len] += 1;
+            if (ct->codes[i] < first_[len])
+                first_[len] = ct->codes[i];
+        }
+
+        for (int len = 1, offset = 0; len <= MaxLength; len++)
+        {
+            offset_[len] = static_cast<uint32_t>(offset);
+            offset += static_cast<int>(count_[len]);
+        }
+
+        for (std::size_t i = 0; i < ct->size; i++)
+        {
+            int len = ct->lengths[i];
+            if (0 == len)
+                continue;
+
+            sorted_[offset_[len] + ct->codes[i] - first_[len]] =
+                static_cast<uint8_t>(i);
+            if (len > LookupBits)
+                continue;
+
+            uint32_t first = ct->codes[i] << (LookupBits - len);
+            uint32_t fill = uint32_t(1) << (LookupBits - len);
+            for (uint32_t k = 0; k < fill; k++)
+                table_[first + k] = static_cast<uint16_t>(i << 4 | len);
+        }
+    }
+
+    int decode_long(bitreader_t* br) const noexcept
+    {
+        for (int len = LookupBits + 1; len <= MaxLength; len++)
+        {
+            uint32_t code = BITREADER_PEEK(br, len);
+            if (code - first_[len] < count_[len])
+            {
+                BITREADER_CONSUME(br, len);
+                return sorted_[offset_[len] + code - first_[len]];
+            }
+        }
+
+        return -1;
+    }
+
+    void decode(const uint8_t* in, std::size_t size,
+                uint8_t* out, std::size_t count)
+    {
+        const uint16_t* table = table_.get();
+        bitreader_t br;
+        std::size_t i = 0;
+
+        bitreader_init(&br, in, size, 0);
+        while (i < count)
+        {
+            int k = per_refill;
+
+            bitreader_refill(&br);
+            if (static_cast<std::size_t>(k) > count - i)
+                k = static_cast<int>(count - i);
+
+            for (; k > 0; k--)
+            {
+                uint16_t entry = table[BITREADER_PEEK(&br, LookupBits)];
+                if (0 != (entry & 0x0f))
+                {
+                    out[i++] = static_cast<uint8_t>(entry >> 4);
+                    BITREADER_CONSUME(&br, entry & 0x0f);
+                    continue;
+                }
+
+                int sym = decode_long(&br);
+                if (sym < 0)
+                    throw error("basic_decoder::decompress", -10);
+
+                out[i++] = static_cast<uint8_t>(sym);
+            }
+        }
+
+        if (bitreader_overrun(&br))
+            throw error("basic_decoder::decompress", -8);
+    }
+
+    codetab ct_;
+    std::unique_ptr<uint16_t[]> table_;
+    std::unique_ptr<uint8_t[]> sorted_;
+    std::array<uint32_t, MaxLength + 1> first_{};
+    std::array<uint32_t, MaxLength + 1> count_{};
+    std::array<uint32_t, MaxLength + 1> offset_{};
+};
+
+using encoder = basic_encoder<>;
+using decoder = basic_decoder<>;
+
+} /* namespace huffman */
+
+#endif
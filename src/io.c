@@ -0,0 +1,635 @@
+#define _GNU_SOURCE
+
+#include "io.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define HUFFMAN_HAVE_URING 1
+#endif
+#endif
+#endif
+
+#ifdef HUFFMAN_HAVE_URING
+
+/*
+ * Bare io_uring over the raw system calls, no liburing. This process is
+ * the only submitter and the only reaper, so the ring indices it owns are
+ * plain loads; only the ones shared with the kernel need ordering.
+ */
+struct uring_s
+{
+    int fd;
+    int fixed;          /* buffers registered, use the _FIXED opcodes */
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ptr;
+    size_t sq_len;
+    void* cq_ptr;
+    size_t cq_len;
+    size_t sqes_len;
+    unsigned pending;   /* queued, not yet handed to the kernel */
+};
+
+typedef struct uring_s uring_t;
+
+static void uring_free(uring_t* ring)
+{
+    if (NULL == ring)
+        return;
+    
+    if (NULL != ring->sqes)
+        munmap(ring->sqes, ring->sqes_len);
+    
+    if (NULL != ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_len);
+    
+    if (NULL != ring->sq_ptr)
+        munmap(ring->sq_ptr, ring->sq_len);
+    
+    close(ring->fd);
+    free(ring);
+}
+
+static uring_t* uring_create(huffman_io_buffer_t* buffers, int depth)
+{
+    struct io_uring_params p;
+    struct iovec iov[HUFFMAN_IO_MAX_DEPTH];
+    uring_t* ring = NULL;
+    uint8_t* sq = NULL;
+    uint8_t* cq = NULL;
+    int fd = 0, i = 0;
+    
+    memset(&p, 0, sizeof(p));
+    fd = (int) syscall(__NR_io_uring_setup, (unsigned) depth, &p);
+    if (fd < 0)
+        return NULL;
+    
+    ring = (uring_t*) calloc(1, sizeof(uring_t));
+    if (NULL == ring)
+    {
+        close(fd);
+        return NULL;
+    }
+    
+    ring->fd = fd;
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_len > ring->sq_len)
+            ring->sq_len = ring->cq_len;
+        
+        ring->cq_len = ring->sq_len;
+    }
+    
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == ring->sq_ptr)
+    {
+        ring->sq_ptr = NULL;
+        uring_free(ring);
+        return NULL;
+    }
+    
+    ring->cq_ptr = ring->sq_ptr;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (MAP_FAILED == ring->cq_ptr)
+        {
+            ring->cq_ptr = NULL;
+            uring_free(ring);
+            return NULL;
+        }
+    }
+    
+    ring->sqes = (struct io_uring_sqe*) mmap(NULL, ring->sqes_len,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (MAP_FAILED == (void*) ring->sqes)
+    {
+        ring->sqes = NULL;
+        uring_free(ring);
+        return NULL;
+    }
+    
+    sq = (uint8_t*) ring->sq_ptr;
+    cq = (uint8_t*) ring->cq_ptr;
+    ring->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned*) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned*) (sq + p.sq_off.array);
+    ring->cq_head = (unsigned*) (cq + p.cq_off.head);
+    ring->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned*) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+    
+    /* Pinned once here so no transfer has to map its pages. Optional. */
+    for (i = 0; i < depth; i++)
+    {
+        iov[i].iov_base = buffers[i].data;
+        iov[i].iov_len = HUFFMAN_IO_BUFFER_SIZE;
+    }
+    
+    ring->fixed = 0 == syscall(__NR_io_uring_register, fd,
+                               IORING_REGISTER_BUFFERS, iov, (unsigned) depth);
+    return ring;
+}
+
+static void uring_queue(uring_t* ring, huffman_io_t* io, int index)
+{
+    huffman_io_buffer_t* b = &io->buffers[index];
+    unsigned tail = *ring->sq_tail;
+    unsigned slot = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[slot];
+    
+    memset(sqe, 0, sizeof(*sqe));
+    if (ring->fixed)
+        sqe->opcode = io->writing ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    else
+        sqe->opcode = io->writing ? IORING_OP_WRITE : IORING_OP_READ;
+    
+    sqe->fd = io->fd;
+    sqe->off = b->offset + b->done;
+    sqe->addr = (uint64_t) (uintptr_t) (b->data + b->done);
+    sqe->len = (unsigned) (b->want - b->done);
+    sqe->buf_index = (uint16_t) index;
+    sqe->user_data = (uint64_t) index;
+    
+    ring->sq_array[slot] = slot;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending += 1;
+}
+
+/* Submit what is queued, wait for min_complete completions. */
+static int uring_enter(uring_t* ring, unsigned min_complete)
+{
+    long ret = 0;
+    
+    do
+    {
+        ret = syscall(__NR_io_uring_enter, ring->fd, ring->pending,
+                      min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0,
+                      NULL, 0);
+    } while (ret < 0 && (EINTR == errno || EAGAIN == errno));
+    
+    if (ret < 0)
+        return -1;
+    
+    ring->pending -= (unsigned) ret;
+    return 0;
+}
+
+#endif
+
+static void io_queue(huffman_io_t* io, int index);
+
+/* Account for a finished transfer; returns 1 when the buffer is done. */
+static int io_complete(huffman_io_t* io, huffman_io_buffer_t* b, long res)
+{
+    if (res < 0)
+    {
+        if (-EINTR == res || -EAGAIN == res)
+            return 0;
+        
+        io->error = 1;
+    }
+    
+    else if (0 == res && io->writing)
+        io->error = 1;
+    
+    b->done += res > 0 ? (size_t) res : 0;
+    if (res > 0 && b->done < b->want)
+        return 0;
+    
+    /* A short read is the end of the file, nothing past it is read. */
+    if (!io->writing)
+        b->want = b->done;
+    
+    b->busy = 0;
+    return 1;
+}
+
+#ifdef HUFFMAN_HAVE_URING
+
+static int io_reap(huffman_io_t* io)
+{
+    uring_t* ring = (uring_t*) io->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    
+    while (head != tail)
+    {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        int index = (int) cqe->user_data;
+        
+        if (!io_complete(io, &io->buffers[index], cqe->res))
+            io_queue(io, index);
+        
+        head += 1;
+    }
+    
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return 0;
+}
+
+#endif
+
+static void io_queue(huffman_io_t* io, int index)
+{
+    huffman_io_buffer_t* b = &io->buffers[index];
+    
+    b->busy = 1;
+    
+#ifdef HUFFMAN_HAVE_URING
+    if (HUFFMAN_IO_URING == io->backend)
+    {
+        uring_queue((uring_t*) io->ring, io, index);
+        return;
+    }
+#endif
+    
+    while (b->busy)
+    {
+        ssize_t res = 0;
+        
+        if (io->writing)
+            res = pwrite(io->fd, b->data + b->done, b->want - b->done,
+                         (off_t) (b->offset + b->done));
+        else
+            res = pread(io->fd, b->data + b->done, b->want - b->done,
+                        (off_t) (b->offset + b->done));
+        
+        io_complete(io, b, res < 0 ? -errno : (long) res);
+    }
+}
+
+static void io_wait(huffman_io_t* io, huffman_io_buffer_t* b)
+{
+#ifdef HUFFMAN_HAVE_URING
+    if (HUFFMAN_IO_URING == io->backend)
+    {
+        uring_t* ring = (uring_t*) io->ring;
+        
+        io_reap(io);
+        while (b->busy)
+        {
+            if (0 != uring_enter(ring, 1))
+            {
+                io->error = 1;
+                b->busy = 0;
+                break;
+            }
+            
+            io_reap(io);
+        }
+    }
+#endif
+    
+    (void) io;
+    (void) b;
+}
+
+static void io_read_ahead(huffman_io_t* io, int index)
+{
+    huffman_io_buffer_t* b = &io->buffers[index];
+    
+    b->offset = io->next;
+    b->want = HUFFMAN_IO_BUFFER_SIZE;
+    b->done = 0;
+    io->next += HUFFMAN_IO_BUFFER_SIZE;
+    io_queue(io, index);
+}
+
+static void io_drain(huffman_io_t* io)
+{
+    int i = 0;
+    
+    for (i = 0; i < io->depth; i++)
+        io_wait(io, &io->buffers[i]);
+}
+
+/* Start a read of every buffer, in file order from io->next. */
+static void io_fill(huffman_io_t* io)
+{
+    int i = 0;
+    
+    io->head = 0;
+    io->pos = 0;
+    for (i = 0; i < io->depth; i++)
+        io_read_ahead(io, i);
+    
+#ifdef HUFFMAN_HAVE_URING
+    if (HUFFMAN_IO_URING == io->backend &&
+        0 != uring_enter((uring_t*) io->ring, 0))
+        io->error = 1;
+#endif
+}
+
+static void io_free(huffman_io_t* io)
+{
+    int i = 0;
+    
+#ifdef HUFFMAN_HAVE_URING
+    uring_free((uring_t*) io->ring);
+#endif
+    
+    if (NULL != io->buffers)
+    {
+        for (i = 0; i < io->depth; i++)
+            free(io->buffers[i].data);
+        
+        free(io->buffers);
+    }
+    
+    free(io);
+}
+
+huffman_io_t* huffman_io_open(FILE* fp, int writing, int backend, int depth)
+{
+    huffman_io_t* io = NULL;
+    long start = 0;
+    int i = 0;
+    
+    if (NULL == fp)
+        return NULL;
+    
+    io = (huffman_io_t*) calloc(1, sizeof(huffman_io_t));
+    if (NULL == io)
+        return NULL;
+    
+    io->fp = fp;
+    io->writing = writing;
+    io->backend = HUFFMAN_IO_STDIO;
+    
+    /* Offsets only mean something on a seekable file. */
+    start = ftell(fp);
+    if (HUFFMAN_IO_STDIO == backend || start < 0 || 0 != fflush(fp))
+        return io;
+    
+#ifndef HUFFMAN_HAVE_URING
+    backend = HUFFMAN_IO_PREAD;
+#endif
+    
+    if (HUFFMAN_IO_PREAD == backend || depth < 1)
+        depth = 1;
+    
+    if (depth > HUFFMAN_IO_MAX_DEPTH)
+        depth = HUFFMAN_IO_MAX_DEPTH;
+    
+    io->fd = fileno(fp);
+    io->start = io->next = io->tell = (uint64_t) start;
+    io->depth = depth;
+    io->buffers = (huffman_io_buffer_t*)
+        calloc((size_t) depth, sizeof(huffman_io_buffer_t));
+    if (NULL == io->buffers)
+    {
+        io_free(io);
+        return NULL;
+    }
+    
+    for (i = 0; i < depth; i++)
+    {
+        io->buffers[i].data = (uint8_t*) malloc(HUFFMAN_IO_BUFFER_SIZE);
+        if (NULL == io->buffers[i].data)
+        {
+            io_free(io);
+            return NULL;
+        }
+        
+        io->buffers[i].offset = io->next;
+        io->buffers[i].want = HUFFMAN_IO_BUFFER_SIZE;
+    }
+    
+    io->backend = HUFFMAN_IO_PREAD;
+#ifdef HUFFMAN_HAVE_URING
+    if (HUFFMAN_IO_URING == backend)
+    {
+        io->ring = uring_create(io->buffers, depth);
+        if (NULL != io->ring)
+            io->backend = HUFFMAN_IO_URING;
+    }
+#endif
+    
+    if (!writing)
+        io_fill(io);
+    
+    return io;
+}
+
+static int io_flush(huffman_io_t* io)
+{
+    huffman_io_buffer_t* b = &io->buffers[io->head];
+    
+    if (io->pos > 0)
+    {
+        b->want = io->pos;
+        b->done = 0;
+        io_queue(io, io->head);
+        io->head = (io->head + 1) % io->depth;
+        io->pos = 0;
+    }
+    
+#ifdef HUFFMAN_HAVE_URING
+    if (HUFFMAN_IO_URING == io->backend &&
+        0 != uring_enter((uring_t*) io->ring, 0))
+        io->error = 1;
+#endif
+    
+    io_drain(io);
+    return io->error ? -1 : 0;
+}
+
+int huffman_io_close(huffman_io_t* io)
+{
+    int ret = 0;
+    
+    if (NULL == io)
+        return -1;
+    
+    if (HUFFMAN_IO_STDIO == io->backend)
+        ret = ferror(io->fp) ? -1 : 0;
+    
+    else
+    {
+        if (io->writing)
+            ret = io_flush(io);
+        else
+            io_drain(io);
+        
+        /* Leave the FILE where a stdio caller would have left it. */
+        if (0 != fseek(io->fp, (long) io->tell, SEEK_SET) || io->error)
+            ret = -1;
+    }
+    
+    io_free(io);
+    return ret;
+}
+
+size_t huffman_io_read(huffman_io_t* io, void* buf, size_t size)
+{
+    uint8_t* p = (uint8_t*) buf;
+    size_t total = 0;
+    
+    if (HUFFMAN_IO_STDIO == io->backend)
+        return fread(buf, 1, size, io->fp);
+    
+    while (total < size && !io->eof && !io->error)
+    {
+        huffman_io_buffer_t* b = &io->buffers[io->head];
+        size_t n = 0;
+        
+        io_wait(io, b);
+        if (io->pos == b->want)
+        {
+            if (b->want < HUFFMAN_IO_BUFFER_SIZE)
+            {
+                io->eof = 1;
+                break;
+            }
+            
+            /* Consumed; reuse it for the read after the last one queued. */
+            io_read_ahead(io, io->head);
+#ifdef HUFFMAN_HAVE_URING
+            if (HUFFMAN_IO_URING == io->backend &&
+                0 != uring_enter((uring_t*) io->ring, 0))
+                io->error = 1;
+#endif
+            io->head = (io->head + 1) % io->depth;
+            io->pos = 0;
+            continue;
+        }
+        
+        n = b->want - io->pos;
+        if (n > size - total)
+            n = size - total;
+        
+        memcpy(p + total, b->data + io->pos, n);
+        io->pos += n;
+        total += n;
+    }
+    
+    io->tell += total;
+    return total;
+}
+
+size_t huffman_io_write(huffman_io_t* io, const void* buf, size_t size)
+{
+    const uint8_t* p = (const uint8_t*) buf;
+    size_t total = 0;
+    
+    if (HUFFMAN_IO_STDIO == io->backend)
+        return fwrite(buf, 1, size, io->fp);
+    
+    while (total < size && !io->error)
+    {
+        huffman_io_buffer_t* b = &io->buffers[io->head];
+        size_t n = 0;
+        
+        if (0 == io->pos)
+        {
+            io_wait(io, b);
+            b->offset = io->next;
+            b->done = 0;
+        }
+        
+        n = HUFFMAN_IO_BUFFER_SIZE - io->pos;
+        if (n > size - total)
+            n = size - total;
+        
+        memcpy(b->data + io->pos, p + total, n);
+        io->pos += n;
+        io->next += n;
+        total += n;
+        
+        if (HUFFMAN_IO_BUFFER_SIZE == io->pos)
+        {
+            b->want = io->pos;
+            io_queue(io, io->head);
+#ifdef HUFFMAN_HAVE_URING
+            if (HUFFMAN_IO_URING == io->backend &&
+                0 != uring_enter((uring_t*) io->ring, 0))
+                io->error = 1;
+#endif
+            io->head = (io->head + 1) % io->depth;
+            io->pos = 0;
+        }
+    }
+    
+    io->tell += total;
+    return total;
+}
+
+int huffman_io_rewind(huffman_io_t* io)
+{
+    if (HUFFMAN_IO_STDIO == io->backend)
+        return fseek(io->fp, (long) io->start, SEEK_SET);
+    
+    if (io->writing)
+        return -1;
+    
+    io_drain(io);
+    if (io->error)
+        return -1;
+    
+    io->eof = 0;
+    io->next = io->tell = io->start;
+    io_fill(io);
+    return io->error ? -1 : 0;
+}
+
+int huffman_io_eof(const huffman_io_t* io)
+{
+    if (HUFFMAN_IO_STDIO == io->backend)
+        return feof(io->fp);
+    
+    return io->eof;
+}
+
+int huffman_io_error(const huffman_io_t* io)
+{
+    if (HUFFMAN_IO_STDIO == io->backend)
+        return ferror(io->fp);
+    
+    return io->error;
+}
+
+static const char* backend_names[] = { "stdio", "pread", "uring" };
+
+int huffman_io_backend(const char* name)
+{
+    int i = 0;
+    
+    for (i = 0; i < 3; i++)
+    {
+        if (!strcmp(name, backend_names[i]))
+            return i;
+    }
+    
+    return -1;
+}
+
+const char* huffman_io_backend_name(int backend)
+{
+    if (backend < 0 || backend > 2)
+        return "unknown";
+    
+    return backend_names[backend];
+}
@@ -0,0 +1,79 @@
+#ifndef ___huffman__io_h___
+#define ___huffman__io_h___
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * Sequential file access for the codec, with fread/fwrite semantics over
+ * one of three backends:
+ *
+ *   HUFFMAN_IO_STDIO  the FILE itself
+ *   HUFFMAN_IO_PREAD  pread/pwrite on its descriptor through a buffer
+ *   HUFFMAN_IO_URING  Linux io_uring, up to depth reads or writes of
+ *                     HUFFMAN_IO_BUFFER_SIZE in flight, into buffers
+ *                     registered with the kernel once at open
+ *
+ * A backend that can not be used falls back to the next one down, io_uring
+ * when the kernel or a sandbox refuses it, pread when the file is a pipe.
+ * backend holds the one actually chosen.
+ */
+#define HUFFMAN_IO_STDIO            0
+#define HUFFMAN_IO_PREAD            1
+#define HUFFMAN_IO_URING            2
+
+#define HUFFMAN_IO_BUFFER_SIZE      (1024 * 1024)
+#define HUFFMAN_IO_DEFAULT_DEPTH    8
+#define HUFFMAN_IO_MAX_DEPTH        64
+
+struct huffman_io_buffer_s
+{
+    uint8_t* data;
+    uint64_t offset;    /* file offset of data[0] */
+    size_t want;        /* bytes to transfer */
+    size_t done;        /* bytes transferred so far */
+    int busy;           /* a transfer is in flight */
+};
+
+typedef struct huffman_io_buffer_s huffman_io_buffer_t;
+
+struct huffman_io_s
+{
+    int backend;
+    int writing;
+    FILE* fp;
+    int fd;
+    uint64_t start;     /* file offset at open */
+    uint64_t next;      /* file offset of the next transfer to submit */
+    uint64_t tell;      /* file offset of the caller's next byte */
+    int depth;
+    huffman_io_buffer_t* buffers;
+    int head;           /* buffer being consumed or filled */
+    size_t pos;         /* position in the head buffer */
+    int eof;
+    int error;
+    void* ring;
+};
+
+typedef struct huffman_io_s huffman_io_t;
+
+huffman_io_t* huffman_io_open(FILE* fp, int writing, int backend, int depth);
+
+int huffman_io_close(huffman_io_t* io);
+
+size_t huffman_io_read(huffman_io_t* io, void* buf, size_t size);
+
+size_t huffman_io_write(huffman_io_t* io, const void* buf, size_t size);
+
+int huffman_io_rewind(huffman_io_t* io);
+
+int huffman_io_eof(const huffman_io_t* io);
+
+int huffman_io_error(const huffman_io_t* io);
+
+int huffman_io_backend(const char* name);
+
+const char* huffman_io_backend_name(int backend);
+
+#endif
@@ -4,6 +4,14 @@
 #include <ctype.h>
 
 #include "huffman.h"
+#include "codec.h"
+#include "cache.h"
+#include "dispatch.h"
+#include "compact.h"
+#include "rle.h"
+#include "server.h"
+#include "client.h"
+#include "bench.h"
 
 void usage(const char* progname)
 {
@@ -12,7 +20,52 @@ void usage(const char* progname)
     printf("commands:\n");
     printf("  stat        show char table of a file\n");
     printf("  encode      encode a file.\n");
-    
+    printf("  decode      decode a file.\n");
+    printf("  cpu         show CPU features and the selected kernels.\n");
+    printf("  serve       run a compression daemon on a UNIX socket.\n");
+    printf("  client      compress or decompress a file through a daemon.\n");
+    printf("  bench       time each codec stage, with hardware counters.\n");
+    printf("\n");
+    printf("encode options:\n");
+    printf("  -s          whole-file table, counts and codes in two passes\n");
+    printf("  -b SIZE     cache blocked, one table per SIZE bytes (default %d)\n",
+           HUFFMAN_DEFAULT_BLOCK_SIZE);
+    printf("  -d DRIFT    keep the last block's table while the byte distribution\n");
+    printf("              of the last %d blocks moved at most DRIFT/1000\n",
+           HUFFMAN_DRIFT_WINDOW_BLOCKS);
+    printf("              (total variation distance)\n");
+    printf("  -c SLOTS    tables kept for reuse by later blocks, 0 to disable\n");
+    printf("              (default %d, at most %d)\n",
+           HUFFMAN_TABLE_CACHE_DEFAULT_SLOTS, HUFFMAN_TABLE_CACHE_MAX_SLOTS);
+    printf("  -f WIDTHS   fixed size records, one table per field per block,\n");
+    printf("              fields given by their widths, e.g. 4,2,8\n");
+    printf("  -k          store CRC32C checksums, verified by decode\n");
+    printf("  -r MIN      code runs of at least MIN equal bytes as run symbols\n");
+    printf("              (block mode, MIN >= %d)\n", HUFFMAN_RLE_MIN_THRESHOLD);
+    printf("\n");
+    printf("decode options:\n");
+    printf("  -j THREADS  decode a single stream (-s) file with THREADS threads\n");
+    printf("  -m          low memory decoder, %d bytes of tables per stream\n",
+           (int) sizeof(huffman_compact_decoder_t));
+    printf("\n");
+    printf("file I/O options, both encode and decode:\n");
+    printf("  -i BACKEND  stdio (default), pread or uring\n");
+    printf("  -q DEPTH    uring transfers in flight (default %d, at most %d)\n",
+           HUFFMAN_IO_DEFAULT_DEPTH, HUFFMAN_IO_MAX_DEPTH);
+    printf("\n");
+    printf("serve SOCKET [options]:\n");
+    printf("  -t SAMPLE   train the preset table on SAMPLE\n");
+    printf("  -w WORKERS  coding threads (default %d)\n",
+           HUFFMAN_SERVER_DEFAULT_WORKERS);
+    printf("  -c CONNS    connections served at once (default %d)\n",
+           HUFFMAN_SERVER_DEFAULT_CONNECTIONS);
+    printf("\n");
+    printf("client SOCKET compress|decompress INPUT OUTPUT\n");
+    printf("\n");
+    printf("bench FILE [options]:\n");
+    printf("  -b SIZE     block size (default %d)\n", HUFFMAN_DEFAULT_BLOCK_SIZE);
+    printf("  -n ITER     passes over the file (default %d)\n",
+           HUFFMAN_BENCH_DEFAULT_ITERATIONS);
 }
 
 int stat_file(const char* filename)
@@ -53,10 +106,10 @@ int stat_file(const char* filename)
             }
             
             printf("CHAR %s'%c'(%d) - %d\n",
-                   is_print ? "c" : "i", // Is printable.
-                   c,                    // Character in string.
-                   item->chval,          // Character value.
-                   (int) item->count     // Character count.
+                   is_print ? "c" : "i", /* Is printable. */
+                   c,                    /* Character in string. */
+                   item->chval,          /* Character value. */
+                   (int) item->count     /* Character count. */
             );
         }
     }
@@ -67,8 +120,338 @@ int stat_file(const char* filename)
     return 0;
 }
 
+int code_file(int encode, int argc, const char* argv[])
+{
+    huffman_options_t opt;
+    const char* input = NULL;
+    const char* output = NULL;
+    FILE* in = NULL;
+    FILE* out = NULL;
+    int i = 0, ret = 0, stream = 0, sized = 0;
+    
+    huffman_options_init(&opt);
+    for (i = 0; i < argc; i++)
+    {
+        if (encode && !strcmp("-s", argv[i]))
+            stream = 1;
+        
+        else if (encode && !strcmp("-b", argv[i]) && i + 1 < argc)
+        {
+            sized = 1;
+            opt.block_size = (size_t) strtoul(argv[++i], NULL, 0);
+        }
+        
+        else if (encode && !strcmp("-d", argv[i]) && i + 1 < argc)
+            opt.reuse_drift = atoi(argv[++i]);
+        
+        else if (encode && !strcmp("-c", argv[i]) && i + 1 < argc)
+            opt.table_cache = (size_t) strtoul(argv[++i], NULL, 0);
+        
+        else if (encode && !strcmp("-f", argv[i]) && i + 1 < argc)
+        {
+            if (0 != huffman_record_layout_parse(&opt.record, argv[++i]))
+                return -1;
+        }
+        
+        else if (encode && !strcmp("-k", argv[i]))
+            opt.checksum = 1;
+        
+        else if (encode && !strcmp("-r", argv[i]) && i + 1 < argc)
+            opt.rle = (size_t) strtoul(argv[++i], NULL, 0);
+        
+        else if (!encode && !strcmp("-j", argv[i]) && i + 1 < argc)
+            opt.threads = atoi(argv[++i]);
+        
+        else if (!encode && !strcmp("-m", argv[i]))
+            opt.compact = 1;
+        
+        else if (!strcmp("-i", argv[i]) && i + 1 < argc)
+        {
+            opt.io = huffman_io_backend(argv[++i]);
+            if (opt.io < 0)
+                return -1;
+        }
+        
+        else if (!strcmp("-q", argv[i]) && i + 1 < argc)
+            opt.io_depth = atoi(argv[++i]);
+        
+        else if (NULL == input)
+            input = argv[i];
+        
+        else if (NULL == output)
+            output = argv[i];
+        
+        else
+            return -1;
+    }
+    
+    if (NULL == input || NULL == output)
+        return -1;
+    
+    /* -s and -f pick the mode, -b only sizes the blocks of the others. */
+    if (stream && (sized || opt.record.fields > 0))
+        return -1;
+    
+    if (stream)
+        opt.mode = HUFFMAN_MODE_STREAM;
+    else if (opt.record.fields > 0)
+        opt.mode = HUFFMAN_MODE_RECORD;
+    
+    in = fopen(input, "rb");
+    if (NULL == in)
+    {
+        fprintf(stderr, "[ERROR] Can not open file '%s'\n", input);
+        return 1;
+    }
+    
+    out = fopen(output, "wb");
+    if (NULL == out)
+    {
+        fprintf(stderr, "[ERROR] Can not open file '%s'\n", output);
+        fclose(in);
+        return 1;
+    }
+    
+    if (encode)
+        ret = huffman_encode_file(in, out, &opt);
+    else
+        ret = huffman_decode_file(in, out, &opt);
+    
+    fclose(in);
+    if (0 != fclose(out) && 0 == ret)
+        ret = -5;
+    
+    if (0 != ret)
+    {
+        fprintf(stderr, "[ERROR] Failed to %s '%s' (%d)\n",
+                encode ? "encode" : "decode", input, ret);
+        return 2;
+    }
+    
+    return 0;
+}
+
+int show_cpu(void)
+{
+    const huffman_kernels_t* list = NULL;
+    size_t i = 0, count = 0;
+    int features = huffman_cpu_features();
+    
+    printf("features:");
+    if (features & HUFFMAN_CPU_BMI2)
+        printf(" bmi2");
+    
+    if (features & HUFFMAN_CPU_AVX2)
+        printf(" avx2");
+    
+    if (features & HUFFMAN_CPU_SSE42)
+        printf(" sse4.2");
+    
+    if (features & HUFFMAN_CPU_CRC32)
+        printf(" crc32");
+    
+    printf("\n");
+    
+    list = huffman_kernels_list(&count);
+    for (i = 0; i < count; i++)
+    {
+        const huffman_kernels_t* k = &list[i];
+        printf("kernels %-12s %s\n", k->name,
+               k == huffman_kernels() ? "selected" :
+               k->required_features == (k->required_features & features) ?
+                   "available" : "unsupported");
+    }
+    
+    return 0;
+}
+
+int serve(int argc, const char* argv[])
+{
+    huffman_server_config_t config;
+    int i = 0, ret = 0;
+    
+    memset(&config, 0, sizeof(config));
+    for (i = 0; i < argc; i++)
+    {
+        if (!strcmp("-t", argv[i]) && i + 1 < argc)
+            config.training_file = argv[++i];
+        
+        else if (!strcmp("-w", argv[i]) && i + 1 < argc)
+            config.workers = atoi(argv[++i]);
+        
+        else if (!strcmp("-c", argv[i]) && i + 1 < argc)
+            config.max_connections = atoi(argv[++i]);
+        
+        else if (NULL == config.socket_path)
+            config.socket_path = argv[i];
+        
+        else
+            return -1;
+    }
+    
+    if (NULL == config.socket_path)
+        return -1;
+    
+    ret = huffman_server_run(&config);
+    if (0 != ret)
+    {
+        fprintf(stderr, "[ERROR] Server on '%s' failed (%d)\n",
+                config.socket_path, ret);
+        return 2;
+    }
+    
+    return 0;
+}
+
+static uint8_t* read_whole_file(const char* filename, size_t* size)
+{
+    uint8_t* buf = NULL;
+    size_t cap = 0, n = 0;
+    FILE* fp = fopen(filename, "rb");
+    
+    if (NULL == fp)
+        return NULL;
+    
+    *size = 0;
+    for (;;)
+    {
+        if (*size == cap)
+        {
+            uint8_t* grown = NULL;
+            cap = cap > 0 ? cap * 2 : 64 * 1024;
+            grown = (uint8_t*) realloc(buf, cap);
+            if (NULL == grown)
+                break;
+            
+            buf = grown;
+        }
+        
+        n = fread(buf + *size, 1, cap - *size, fp);
+        *size += n;
+        if (0 == n)
+        {
+            fclose(fp);
+            return buf;
+        }
+    }
+    
+    fclose(fp);
+    free(buf);
+    return NULL;
+}
+
+int bench(int argc, const char* argv[])
+{
+    huffman_bench_config_t config;
+    huffman_bench_result_t result;
+    const char* filename = NULL;
+    uint8_t* data = NULL;
+    size_t size = 0;
+    int i = 0, ret = 0;
+    
+    memset(&config, 0, sizeof(config));
+    for (i = 0; i < argc; i++)
+    {
+        if (!strcmp("-b", argv[i]) && i + 1 < argc)
+            config.block_size = (size_t) strtoul(argv[++i], NULL, 0);
+        
+        else if (!strcmp("-n", argv[i]) && i + 1 < argc)
+            config.iterations = atoi(argv[++i]);
+        
+        else if (NULL == filename)
+            filename = argv[i];
+        
+        else
+            return -1;
+    }
+    
+    if (NULL == filename)
+        return -1;
+    
+    data = read_whole_file(filename, &size);
+    if (NULL == data)
+    {
+        fprintf(stderr, "[ERROR] Can not read '%s'\n", filename);
+        return 2;
+    }
+    
+    ret = huffman_bench_run(&config, data, size, &result);
+    free(data);
+    if (0 != ret)
+    {
+        fprintf(stderr, "[ERROR] Benchmark of '%s' failed (%d)\n",
+                filename, ret);
+        return 2;
+    }
+    
+    huffman_bench_report(&result, stdout);
+    return 0;
+}
+
+int client(int argc, const char* argv[])
+{
+    uint8_t* in = NULL;
+    uint8_t* out = NULL;
+    size_t in_size = 0, out_size = 0;
+    FILE* fp = NULL;
+    int op = 0, fd = -1, ret = 0;
+    
+    if (4 != argc)
+        return -1;
+    
+    if (!strcmp("compress", argv[1]))
+        op = HUFFMAN_SERVER_OP_COMPRESS;
+    else if (!strcmp("decompress", argv[1]))
+        op = HUFFMAN_SERVER_OP_DECOMPRESS;
+    else
+        return -1;
+    
+    in = read_whole_file(argv[2], &in_size);
+    if (NULL == in)
+    {
+        fprintf(stderr, "[ERROR] Can not read file '%s'\n", argv[2]);
+        return 1;
+    }
+    
+    fd = huffman_client_connect(argv[0]);
+    if (fd < 0)
+    {
+        fprintf(stderr, "[ERROR] Can not connect to '%s'\n", argv[0]);
+        free(in);
+        return 1;
+    }
+    
+    ret = huffman_client_request(fd, op, in, in_size, &out, &out_size);
+    huffman_client_close(fd);
+    free(in);
+    
+    if (0 != ret)
+    {
+        fprintf(stderr, "[ERROR] Failed to %s '%s' (%d)\n",
+                argv[1], argv[2], ret);
+        return 2;
+    }
+    
+    fp = fopen(argv[3], "wb");
+    if (NULL == fp || out_size != fwrite(out, 1, out_size, fp))
+        ret = 1;
+    
+    if (NULL != fp && 0 != fclose(fp))
+        ret = 1;
+    
+    free(out);
+    if (0 != ret)
+        fprintf(stderr, "[ERROR] Can not write file '%s'\n", argv[3]);
+    
+    return ret;
+}
+
 int main(int argc, const char* argv[])
 {
+    int ret = -1;
+    
+    huffman_kernels_init();
+    
     if (argc <= 1)
     {
         usage(argv[0]);
@@ -78,10 +461,30 @@ int main(int argc, const char* argv[])
     if (!strcmp("stat", argv[1]))
     {
         if (argc >= 3)
-            return stat_file(argv[2]);
-        else
-            usage(argv[0]);
+            ret = stat_file(argv[2]);
     }
     
-    return 0;
+    else if (!strcmp("cpu", argv[1]))
+        ret = show_cpu();
+    
+    else if (!strcmp("encode", argv[1]) || !strcmp("decode", argv[1]))
+        ret = code_file('e' == argv[1][0], argc - 2, argv + 2);
+    
+    else if (!strcmp("bench", argv[1]))
+        ret = bench(argc - 2, argv + 2);
+    
+    else if (!strcmp("serve", argv[1]))
+        ret = serve(argc - 2, argv + 2);
+    
+    else if (!strcmp("client", argv[1]))
+        ret = client(argc - 2, argv + 2);
+    
+    /* Bad arguments or an unknown command. */
+    if (ret < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    return ret;
 }
@@ -0,0 +1,277 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "parallel.h"
+
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * Parallel decoding of one unframed stream.
+ *
+ * The payload is cut into chunks at arbitrary bit offsets. Every chunk but
+ * the first is decoded speculatively from its cut, which is most likely
+ * not a symbol boundary. Huffman codes resynchronize quickly though: once
+ * a speculative decoder lands on a true boundary it stays on true ones.
+ * Each chunk therefore remembers where its first symbols started. The
+ * stitch pass walks the chunks in order. From the true boundary the
+ * previous chunk ended on it decodes for real until it reaches one of
+ * those remembered boundaries; from there on the chunk's own symbols are
+ * correct and are copied. A chunk that never lines up within its
+ * remembered boundaries is decoded again in full.
+ */
+struct decode_chunk_s
+{
+    const huffman_decoder_t* dec;
+    const uint8_t* data;
+    size_t size;
+    size_t start;           /* first bit to decode from */
+    size_t end;             /* stop at the first boundary at or past this */
+    uint8_t* out;
+    size_t cap;
+    size_t count;           /* symbols decoded */
+    size_t stop;            /* boundary decoding stopped on */
+    size_t* sync;           /* start bit of the first symbols */
+    int failed;
+};
+
+typedef struct decode_chunk_s decode_chunk_t;
+
+static void* decode_chunk(void* arg)
+{
+    decode_chunk_t* c = (decode_chunk_t*) arg;
+    const uint16_t* table = c->dec->table;
+    int bits = c->dec->bits;
+    bitreader_t br;
+    size_t n = 0, pos = 0;
+    
+    bitreader_init(&br, c->data, c->size, c->start);
+    c->failed = 0;
+    
+    for (pos = c->start; pos < c->end && n < c->cap; pos = bitreader_tell(&br))
+    {
+        uint16_t entry = 0;
+        
+        if (NULL != c->sync && n < HUFFMAN_PARALLEL_SYNC_POINTS)
+            c->sync[n] = pos;
+        
+        if (br.count < bits)
+            bitreader_refill(&br);
+        
+        entry = table[BITREADER_PEEK(&br, bits)];
+        if (0 == (entry & 0x0f))
+        {
+            c->failed = 1;
+            break;
+        }
+        
+        c->out[n++] = (uint8_t) (entry >> 4);
+        BITREADER_CONSUME(&br, entry & 0x0f);
+    }
+    
+    c->count = n;
+    c->stop = bitreader_tell(&br);
+    return NULL;
+}
+
+static int decoder_min_length(const huffman_decoder_t* dec)
+{
+    size_t i = 0;
+    int min = dec->bits;
+    
+    for (i = 0; i < ((size_t) 1 << dec->bits); i++)
+    {
+        int len = dec->table[i] & 0x0f;
+        if (len > 0 && len < min)
+            min = len;
+    }
+    
+    return min;
+}
+
+/* Run every chunk, chunk 0 on the calling thread. */
+static void decode_chunks(decode_chunk_t* chunks, int threads)
+{
+    pthread_t* tids = (pthread_t*) calloc((size_t) threads, sizeof(pthread_t));
+    int* started = (int*) calloc((size_t) threads, sizeof(int));
+    int i = 0;
+    
+    for (i = 1; i < threads; i++)
+    {
+        if (NULL != tids && NULL != started)
+            started[i] =
+                0 == pthread_create(&tids[i], NULL, decode_chunk, &chunks[i]);
+    }
+    
+    decode_chunk(&chunks[0]);
+    
+    /* Whatever could not get a thread runs here. */
+    for (i = 1; i < threads; i++)
+    {
+        if (NULL != started && started[i])
+            pthread_join(tids[i], NULL);
+        else
+            decode_chunk(&chunks[i]);
+    }
+    
+    free(tids);
+    free(started);
+}
+
+static int stitch_chunks(
+    decode_chunk_t* chunks,
+    int threads,
+    uint8_t* out,
+    size_t out_size
+)
+{
+    size_t done = 0, pos = 0;
+    int i = 0;
+    
+    if (chunks[0].failed)
+        return -10;
+    
+    done = chunks[0].count;
+    pos = chunks[0].stop;
+    for (i = 1; i < threads && done < out_size; i++)
+    {
+        decode_chunk_t* c = &chunks[i];
+        const uint16_t* table = c->dec->table;
+        int bits = c->dec->bits;
+        size_t k = 0, nsync = c->failed ? 0 : c->count;
+        bitreader_t br;
+        
+        if (nsync > HUFFMAN_PARALLEL_SYNC_POINTS)
+            nsync = HUFFMAN_PARALLEL_SYNC_POINTS;
+        
+        /* Walk the true boundaries until they meet the speculative ones. */
+        bitreader_init(&br, c->data, c->size, pos);
+        while (pos < c->end && done < out_size)
+        {
+            uint16_t entry = 0;
+            
+            while (k < nsync && c->sync[k] < pos)
+                k++;
+            
+            if (k >= nsync || c->sync[k] == pos)
+                break;
+            
+            if (br.count < bits)
+                bitreader_refill(&br);
+            
+            entry = table[BITREADER_PEEK(&br, bits)];
+            if (0 == (entry & 0x0f))
+                return -10;
+            
+            out[done++] = (uint8_t) (entry >> 4);
+            BITREADER_CONSUME(&br, entry & 0x0f);
+            pos = bitreader_tell(&br);
+        }
+        
+        if (pos >= c->end || done >= out_size)
+            continue;
+        
+        if (k < nsync)
+        {
+            size_t n = c->count - k;
+            if (n > out_size - done)
+                n = out_size - done;
+            
+            memcpy(out + done, c->out + k, n);
+            done += n;
+            pos = c->stop;
+            continue;
+        }
+        
+        /* Never lined up with the true boundaries: decode it again. */
+        c->sync = NULL;
+        c->start = pos;
+        c->out = out + done;
+        c->cap = out_size - done;
+        decode_chunk(c);
+        
+        if (c->failed)
+            return -10;
+        
+        done += c->count;
+        pos = c->stop;
+    }
+    
+    return done < out_size ? -8 : 0;
+}
+
+int huffman_decode_parallel(
+    const huffman_decoder_t* dec,
+    const uint8_t* data,
+    size_t size,
+    uint8_t* out,
+    size_t out_size,
+    int threads
+)
+{
+    decode_chunk_t* chunks = NULL;
+    uint8_t** outs = NULL;
+    size_t** syncs = NULL;
+    size_t total_bits = size * 8;
+    int i = 0, min_len = 0, ret = 0;
+    
+    if (NULL == dec || (NULL == data && size > 0) ||
+        (NULL == out && out_size > 0))
+        return -1;
+    
+    if ((size_t) threads > size / HUFFMAN_PARALLEL_MIN_CHUNK)
+        threads = (int) (size / HUFFMAN_PARALLEL_MIN_CHUNK);
+    
+    if (threads < 1)
+        threads = 1;
+    
+    min_len = decoder_min_length(dec);
+    chunks = (decode_chunk_t*) calloc((size_t) threads, sizeof(decode_chunk_t));
+    outs = (uint8_t**) calloc((size_t) threads, sizeof(uint8_t*));
+    syncs = (size_t**) calloc((size_t) threads, sizeof(size_t*));
+    if (NULL == chunks || NULL == outs || NULL == syncs)
+        ret = -7;
+    
+    /* Chunk 0 starts on a true boundary and decodes straight into out. */
+    for (i = 0; 0 == ret && i < threads; i++)
+    {
+        decode_chunk_t* c = &chunks[i];
+        
+        c->dec = dec;
+        c->data = data;
+        c->size = size;
+        c->start = total_bits / (size_t) threads * (size_t) i;
+        c->end = i + 1 < threads ?
+            total_bits / (size_t) threads * (size_t) (i + 1) : total_bits;
+        
+        if (0 == i)
+        {
+            c->out = out;
+            c->cap = out_size;
+            continue;
+        }
+        
+        c->cap = (c->end - c->start) / (size_t) min_len + 1;
+        c->out = outs[i] = (uint8_t*) malloc(c->cap);
+        c->sync = syncs[i] = (size_t*)
+            malloc(HUFFMAN_PARALLEL_SYNC_POINTS * sizeof(size_t));
+        if (NULL == c->out || NULL == c->sync)
+            ret = -7;
+    }
+    
+    if (0 == ret)
+    {
+        decode_chunks(chunks, threads);
+        ret = stitch_chunks(chunks, threads, out, out_size);
+    }
+    
+    for (i = 0; NULL != outs && NULL != syncs && i < threads; i++)
+    {
+        free(outs[i]);
+        free(syncs[i]);
+    }
+    
+    free(outs);
+    free(syncs);
+    free(chunks);
+    return ret;
+}
@@ -0,0 +1,24 @@
+#ifndef ___huffman__parallel_h___
+#define ___huffman__parallel_h___
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "codec.h"
+
+/* Boundaries each speculative chunk remembers for resynchronization. */
+#define HUFFMAN_PARALLEL_SYNC_POINTS    4096
+
+/* Chunks smaller than this are not worth a thread. */
+#define HUFFMAN_PARALLEL_MIN_CHUNK      (64 * 1024)
+
+int huffman_decode_parallel(
+    const huffman_decoder_t* dec,
+    const uint8_t* data,
+    size_t size,
+    uint8_t* out,
+    size_t out_size,
+    int threads
+);
+
+#endif
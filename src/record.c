@@ -0,0 +1,135 @@
+#include "record.h"
+
+#include <string.h>
+
+int huffman_record_layout_init(
+    huffman_record_layout_t* layout,
+    const size_t* widths,
+    int fields
+)
+{
+    int i = 0;
+    
+    if (NULL == layout || NULL == widths ||
+        fields < 1 || fields > HUFFMAN_RECORD_MAX_FIELDS)
+        return -1;
+    
+    layout->fields = fields;
+    layout->size = 0;
+    for (i = 0; i < fields; i++)
+    {
+        if (0 == widths[i] || widths[i] > HUFFMAN_RECORD_MAX_WIDTH)
+            return -2;
+        
+        layout->widths[i] = widths[i];
+        layout->offsets[i] = layout->size;
+        layout->size += widths[i];
+    }
+    
+    return 0;
+}
+
+int huffman_record_layout_parse(
+    huffman_record_layout_t* layout,
+    const char* spec
+)
+{
+    size_t widths[HUFFMAN_RECORD_MAX_FIELDS];
+    const char* p = spec;
+    char* end = NULL;
+    int fields = 0;
+    
+    if (NULL == layout || NULL == spec)
+        return -1;
+    
+    for (;;)
+    {
+        unsigned long width = strtoul(p, &end, 10);
+        
+        if (end == p || fields == HUFFMAN_RECORD_MAX_FIELDS)
+            return -2;
+        
+        widths[fields++] = (size_t) width;
+        if ('\0' == *end)
+            break;
+        
+        if (',' != *end)
+            return -2;
+        
+        p = end + 1;
+    }
+    
+    return huffman_record_layout_init(layout, widths, fields);
+}
+
+size_t huffman_record_column_size(
+    const huffman_record_layout_t* layout,
+    int field,
+    size_t size
+)
+{
+    size_t tail = size % layout->size;
+    size_t extra = 0;
+    
+    if (tail > layout->offsets[field])
+    {
+        extra = tail - layout->offsets[field];
+        if (extra > layout->widths[field])
+            extra = layout->widths[field];
+    }
+    
+    return size / layout->size * layout->widths[field] + extra;
+}
+
+size_t huffman_record_gather(
+    const huffman_record_layout_t* layout,
+    int field,
+    const uint8_t* in,
+    size_t size,
+    uint8_t* column
+)
+{
+    size_t width = layout->widths[field];
+    size_t count = huffman_record_column_size(layout, field, size);
+    size_t pos = layout->offsets[field], i = 0;
+    
+    /* Byte wide fields are a plain strided copy. */
+    if (1 == width)
+    {
+        for (i = 0; i < count; i++, pos += layout->size)
+            column[i] = in[pos];
+        
+        return count;
+    }
+    
+    for (i = 0; i < count; i += width, pos += layout->size)
+        memcpy(column + i, in + pos, count - i < width ? count - i : width);
+    
+    return count;
+}
+
+size_t huffman_record_scatter(
+    const huffman_record_layout_t* layout,
+    int field,
+    const uint8_t* column,
+    uint8_t* out,
+    size_t size
+)
+{
+    size_t width = layout->widths[field];
+    size_t count = huffman_record_column_size(layout, field, size);
+    size_t pos = layout->offsets[field], i = 0;
+    
+    if (1 == width)
+    {
+        for (i = 0; i < count; i++, pos += layout->size)
+            out[pos] = column[i];
+        
+        return count;
+    }
+    
+    for (i = 0; i < count; i += width, pos += layout->size)
+        memcpy(out + pos, column + i, count - i < width ? count - i : width);
+    
+    return count;
+}
@@ -0,0 +1,66 @@
+#ifndef ___huffman__record_h___
+#define ___huffman__record_h___
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * Layout of fixed size records as consecutive fields of given widths.
+ * Each field, or group of columns given one width, is counted and coded
+ * on its own, so a field whose bytes follow a distribution of their own
+ * (a tag, a length, a timestamp) gets a table of its own.
+ *
+ * A field's column is its bytes from every record of a buffer, in
+ * record order. A buffer may end in a partial record, which adds the
+ * bytes it holds to the first fields' columns.
+ */
+#define HUFFMAN_RECORD_MAX_FIELDS   16
+#define HUFFMAN_RECORD_MAX_WIDTH    65535
+
+struct huffman_record_layout_s
+{
+    int fields;
+    size_t widths[HUFFMAN_RECORD_MAX_FIELDS];
+    size_t offsets[HUFFMAN_RECORD_MAX_FIELDS];
+    size_t size;
+};
+
+typedef struct huffman_record_layout_s huffman_record_layout_t;
+
+int huffman_record_layout_init(
+    huffman_record_layout_t* layout,
+    const size_t* widths,
+    int fields
+);
+
+/* Widths separated by commas, e.g. "4,2,8". */
+int huffman_record_layout_parse(
+    huffman_record_layout_t* layout,
+    const char* spec
+);
+
+size_t huffman_record_column_size(
+    const huffman_record_layout_t* layout,
+    int field,
+    size_t size
+);
+
+/* Copies field's column out of size bytes of records, returns its size. */
+size_t huffman_record_gather(
+    const huffman_record_layout_t* layout,
+    int field,
+    const uint8_t* in,
+    size_t size,
+    uint8_t* column
+);
+
+/* Puts field's column back into size bytes of records. */
+size_t huffman_record_scatter(
+    const huffman_record_layout_t* layout,
+    int field,
+    const uint8_t* column,
+    uint8_t* out,
+    size_t size
+);
+
+#endif
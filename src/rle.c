@@ -0,0 +1,176 @@
+#include "rle.h"
+
+#include <string.h>
+
+/* Length of the run of equal bytes starting at in[0]. */
+static size_t rle_run_length(const uint8_t* in, size_t size)
+{
+    size_t n = 1;
+    
+    while (n < size && in[n] == in[0])
+        n += 1;
+    
+    return n;
+}
+
+/* Run symbol for n repeats, n between 1 and HUFFMAN_RLE_MAX_RUN. */
+static int rle_run_bits(size_t n)
+{
+    int k = 0;
+    
+    while (n >> (k + 1))
+        k += 1;
+    
+    return k;
+}
+
+int huffman_rle_count(
+    chartab_t* tab,
+    const uint8_t* in,
+    size_t size,
+    size_t threshold
+)
+{
+    size_t i = 0, run = 0, n = 0;
+    
+    if (NULL == tab || NULL == tab->items || (NULL == in && size > 0) ||
+        tab->size < HUFFMAN_RLE_ALPHABET_SIZE ||
+        threshold < HUFFMAN_RLE_MIN_THRESHOLD)
+        return -1;
+    
+    while (i < size)
+    {
+        run = rle_run_length(in + i, size - i);
+        if (run < threshold)
+        {
+            tab->items[in[i]].count += run;
+            i += run;
+            continue;
+        }
+        
+        tab->items[in[i]].count += 1;
+        i += run;
+        for (run -= 1; run > 0; run -= n)
+        {
+            n = run < HUFFMAN_RLE_MAX_RUN ? run : HUFFMAN_RLE_MAX_RUN;
+            tab->items[HUFFMAN_ASCII_BYTE_CHARTAB_SIZE + rle_run_bits(n)]
+                .count += 1;
+        }
+    }
+    
+    return 0;
+}
+
+int huffman_rle_encode(
+    const huffman_codetab_t* ct,
+    const uint8_t* in,
+    size_t size,
+    size_t threshold,
+    bitwriter_t* bw
+)
+{
+    const uint8_t* lengths = NULL;
+    const uint32_t* codes = NULL;
+    size_t i = 0, k = 0, run = 0, n = 0;
+    int sym = 0, bits = 0;
+    
+    if (NULL == ct || NULL == bw || (NULL == in && size > 0) ||
+        ct->size < HUFFMAN_RLE_ALPHABET_SIZE ||
+        threshold < HUFFMAN_RLE_MIN_THRESHOLD)
+        return -1;
+    
+    lengths = ct->lengths;
+    codes = ct->codes;
+    while (i < size)
+    {
+        sym = in[i];
+        if (0 == lengths[sym])
+            return -2;
+        
+        run = rle_run_length(in + i, size - i);
+        i += run;
+        if (run < threshold)
+        {
+            for (k = 0; k < run; k++)
+                BITWRITER_PUT(bw, codes[sym], lengths[sym]);
+            
+            continue;
+        }
+        
+        BITWRITER_PUT(bw, codes[sym], lengths[sym]);
+        for (run -= 1; run > 0; run -= n)
+        {
+            n = run < HUFFMAN_RLE_MAX_RUN ? run : HUFFMAN_RLE_MAX_RUN;
+            bits = rle_run_bits(n);
+            sym = HUFFMAN_ASCII_BYTE_CHARTAB_SIZE + bits;
+            if (0 == lengths[sym])
+                return -2;
+            
+            BITWRITER_PUT(bw, codes[sym], lengths[sym]);
+            if (bits > 0)
+                BITWRITER_PUT(bw, n - ((size_t) 1 << bits), bits);
+        }
+    }
+    
+    bitwriter_spill(bw);
+    return bw->overflow ? -3 : 0;
+}
+
+int huffman_rle_decode(
+    const huffman_decoder_t* dec,
+    bitreader_t* br,
+    uint8_t* out,
+    size_t size
+)
+{
+    const uint16_t* table = NULL;
+    size_t pos = 0, run = 0;
+    int bits = 0;
+    
+    if (NULL == dec || NULL == br || (NULL == out && size > 0))
+        return -1;
+    
+    table = dec->table;
+    bits = dec->bits;
+    while (pos < size)
+    {
+        uint16_t entry = 0;
+        int len = 0, sym = 0, k = 0;
+        
+        /* Room for the longest code and its extra bits. */
+        if (br->count < 2 * HUFFMAN_MAX_CODE_LENGTH)
+            bitreader_refill(br);
+        
+        entry = table[BITREADER_PEEK(br, bits)];
+        len = entry & 0x0f;
+        if (0 == len)
+            return -2;
+        
+        BITREADER_CONSUME(br, len);
+        sym = entry >> 4;
+        if (sym < HUFFMAN_ASCII_BYTE_CHARTAB_SIZE)
+        {
+            out[pos++] = (uint8_t) sym;
+            continue;
+        }
+        
+        k = sym - HUFFMAN_ASCII_BYTE_CHARTAB_SIZE;
+        if (k >= HUFFMAN_RLE_RUN_SYMBOLS)
+            return -2;
+        
+        run = (size_t) 1 << k;
+        if (k > 0)
+        {
+            run += BITREADER_PEEK(br, k);
+            BITREADER_CONSUME(br, k);
+        }
+        
+        if (0 == pos || run > size - pos)
+            return -3;
+        
+        memset(out + pos, out[pos - 1], run);
+        pos += run;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef ___huffman__rle_h___
+#define ___huffman__rle_h___
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "bitstream.h"
+#include "huffman.h"
+#include "codec.h"
+
+/*
+ * Run-length pre-pass over an extended alphabet. Symbols 0..255 are
+ * literal bytes. Symbol 256 + k repeats the byte before it n times, for
+ * 2^k <= n < 2^(k+1), with n - 2^k following the code in k raw bits.
+ *
+ * A run of at least threshold equal bytes is coded as its first byte and
+ * run symbols for the rest; a run longer than HUFFMAN_RLE_MAX_RUN takes
+ * several. Shorter runs stay literals. With threshold >= 2 no byte costs
+ * more than HUFFMAN_MAX_CODE_LENGTH bits, so huffman_encode_bound() holds.
+ */
+#define HUFFMAN_RLE_RUN_SYMBOLS         16
+#define HUFFMAN_RLE_ALPHABET_SIZE       \
+    (HUFFMAN_ASCII_BYTE_CHARTAB_SIZE + HUFFMAN_RLE_RUN_SYMBOLS)
+#define HUFFMAN_RLE_MAX_RUN             ((1 << HUFFMAN_RLE_RUN_SYMBOLS) - 1)
+#define HUFFMAN_RLE_MIN_THRESHOLD       2
+
+/* Counts the symbols coding in would produce into tab. */
+int huffman_rle_count(
+    chartab_t* tab,
+    const uint8_t* in,
+    size_t size,
+    size_t threshold
+);
+
+int huffman_rle_encode(
+    const huffman_codetab_t* ct,
+    const uint8_t* in,
+    size_t size,
+    size_t threshold,
+    bitwriter_t* bw
+);
+
+/* Decodes symbols until size bytes are out, runs expand with memset. */
+int huffman_rle_decode(
+    const huffman_decoder_t* dec,
+    bitreader_t* br,
+    uint8_t* out,
+    size_t size
+);
+
+#endif
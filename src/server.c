@@ -0,0 +1,559 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "server.h"
+#include "client.h"
+#include "codec.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * One thread per connection reads frames and queues them as jobs. A fixed
+ * pool of workers, each with its own warm huffman_context_t, takes up to
+ * HUFFMAN_SERVER_BATCH jobs per trip to the queue, codes them and wakes
+ * the connection threads to send the replies.
+ *
+ * Only the accepting thread takes SIGINT and SIGTERM. Their handler, and
+ * a connection thread that finishes, write a byte to a pipe the accept
+ * loop polls next to the listening socket.
+ *
+ * On the way out, requests still queued are coded, new ones are refused,
+ * every open connection is shut down, and huffman_server_run() waits for
+ * the last connection thread before freeing what they share.
+ */
+struct server_job_s
+{
+    int op;
+    const uint8_t* in;
+    size_t in_size;
+    uint8_t* out;
+    size_t out_size;
+    int status;
+    int done;
+    pthread_cond_t cond;
+    struct server_job_s* next;
+};
+
+typedef struct server_job_s server_job_t;
+
+typedef struct server_conn_s server_conn_t;
+
+struct server_s
+{
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t idle;
+    server_job_t* head;
+    server_job_t* tail;
+    server_conn_t* conns;
+    const huffman_codetab_t* preset;
+    int stopping;
+    int connections;
+};
+
+typedef struct server_s server_t;
+
+struct server_conn_s
+{
+    server_t* server;
+    int fd;
+    struct server_conn_s* next;
+};
+
+static volatile sig_atomic_t server_interrupted = 0;
+static int server_wake_fd = -1;
+
+static void server_wake(void)
+{
+    char c = 0;
+    
+    /* A full pipe already has the loop awake, the byte is not needed. */
+    if (write(server_wake_fd, &c, 1) < 0)
+        return;
+}
+
+static void server_on_signal(int sig)
+{
+    int saved = errno;
+    
+    (void) sig;
+    server_interrupted = 1;
+    server_wake();
+    errno = saved;
+}
+
+static void server_job_run(huffman_context_t* ctx, server_job_t* job)
+{
+    size_t cap = 0;
+    
+    if (HUFFMAN_SERVER_OP_COMPRESS == job->op)
+        cap = huffman_compress_bound(job->in_size);
+    
+    else if (HUFFMAN_SERVER_OP_DECOMPRESS == job->op)
+    {
+        job->status = huffman_decompressed_size(job->in, job->in_size, &cap);
+        if (0 != job->status)
+            return;
+        
+        if (cap > HUFFMAN_SERVER_MAX_PAYLOAD)
+        {
+            job->status = -9;
+            return;
+        }
+    }
+    
+    else
+    {
+        job->status = -1;
+        return;
+    }
+    
+    job->out = (uint8_t*) malloc(cap > 0 ? cap : 1);
+    if (NULL == job->out)
+    {
+        job->status = -7;
+        return;
+    }
+    
+    if (HUFFMAN_SERVER_OP_COMPRESS == job->op)
+        job->status = huffman_compress(ctx, job->in, job->in_size,
+                                       job->out, cap, &job->out_size);
+    else
+        job->status = huffman_decompress(ctx, job->in, job->in_size,
+                                         job->out, cap, &job->out_size);
+}
+
+static void* server_worker(void* arg)
+{
+    server_t* server = (server_t*) arg;
+    server_job_t* batch[HUFFMAN_SERVER_BATCH];
+    huffman_context_t* ctx = huffman_context_create(server->preset);
+    int n = 0, i = 0;
+    
+    for (;;)
+    {
+        pthread_mutex_lock(&server->lock);
+        while (NULL == server->head && !server->stopping)
+            pthread_cond_wait(&server->ready, &server->lock);
+        
+        if (NULL == server->head)
+        {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        
+        for (n = 0; n < HUFFMAN_SERVER_BATCH && NULL != server->head; n++)
+        {
+            batch[n] = server->head;
+            server->head = server->head->next;
+        }
+        
+        if (NULL == server->head)
+            server->tail = NULL;
+        
+        pthread_mutex_unlock(&server->lock);
+        
+        for (i = 0; i < n; i++)
+        {
+            if (NULL == ctx)
+                batch[i]->status = -7;
+            else
+                server_job_run(ctx, batch[i]);
+        }
+        
+        pthread_mutex_lock(&server->lock);
+        for (i = 0; i < n; i++)
+        {
+            batch[i]->done = 1;
+            pthread_cond_signal(&batch[i]->cond);
+        }
+        pthread_mutex_unlock(&server->lock);
+    }
+    
+    huffman_context_free(ctx);
+    return NULL;
+}
+
+static int server_submit(server_t* server, server_job_t* job)
+{
+    job->status = 0;
+    job->done = 0;
+    job->out = NULL;
+    job->out_size = 0;
+    job->next = NULL;
+    if (0 != pthread_cond_init(&job->cond, NULL))
+        return -7;
+    
+    /* No worker is left to answer once the server is stopping. */
+    pthread_mutex_lock(&server->lock);
+    if (server->stopping)
+    {
+        pthread_mutex_unlock(&server->lock);
+        pthread_cond_destroy(&job->cond);
+        return -7;
+    }
+    
+    if (NULL == server->tail)
+        server->head = job;
+    else
+        server->tail->next = job;
+    
+    server->tail = job;
+    pthread_cond_signal(&server->ready);
+    
+    while (!job->done)
+        pthread_cond_wait(&job->cond, &server->lock);
+    
+    pthread_mutex_unlock(&server->lock);
+    pthread_cond_destroy(&job->cond);
+    return 0;
+}
+
+static void server_conn_add(server_t* server, server_conn_t* conn)
+{
+    pthread_mutex_lock(&server->lock);
+    conn->next = server->conns;
+    server->conns = conn;
+    server->connections += 1;
+    pthread_mutex_unlock(&server->lock);
+}
+
+/*
+ * Unlinked before its fd is closed, so a shutdown at stop never hits a
+ * reused descriptor. The wake and the signal happen under the lock, as
+ * the pipe and the server are freed as soon as the count reaches zero.
+ */
+static void server_conn_remove(server_conn_t* conn)
+{
+    server_t* server = conn->server;
+    server_conn_t** link = &server->conns;
+    
+    pthread_mutex_lock(&server->lock);
+    while (NULL != *link && conn != *link)
+        link = &(*link)->next;
+    
+    if (NULL != *link)
+        *link = conn->next;
+    
+    server->connections -= 1;
+    server_wake();
+    if (0 == server->connections)
+        pthread_cond_broadcast(&server->idle);
+    
+    pthread_mutex_unlock(&server->lock);
+}
+
+static void* server_connection(void* arg)
+{
+    server_conn_t* conn = (server_conn_t*) arg;
+    uint8_t header[HUFFMAN_SERVER_REQUEST_SIZE];
+    uint8_t reply[HUFFMAN_SERVER_RESPONSE_SIZE];
+    
+    while (0 == huffman_socket_read_full(conn->fd, header, sizeof(header)))
+    {
+        server_job_t job;
+        uint8_t* payload = NULL;
+        size_t length = (size_t) huffman_get_le(header + 8, 4);
+        int ok = 0;
+        
+        if (0 != memcmp(header, HUFFMAN_SERVER_MAGIC, 4) ||
+            length > HUFFMAN_SERVER_MAX_PAYLOAD)
+            break;
+        
+        payload = (uint8_t*) malloc(length > 0 ? length : 1);
+        if (NULL == payload)
+            break;
+        
+        if (0 != huffman_socket_read_full(conn->fd, payload, length))
+        {
+            free(payload);
+            break;
+        }
+        
+        job.op = header[4];
+        job.in = payload;
+        job.in_size = length;
+        if (0 != server_submit(conn->server, &job))
+            job.status = -7;
+        
+        if (0 != job.status)
+            job.out_size = 0;
+        
+        huffman_put_le(reply, (uint32_t) job.status, 4);
+        huffman_put_le(reply + 4, job.out_size, 4);
+        ok = 0 == huffman_socket_write_full(conn->fd, reply, sizeof(reply)) &&
+            0 == huffman_socket_write_full(conn->fd, job.out, job.out_size);
+        
+        free(job.out);
+        free(payload);
+        if (!ok)
+            break;
+    }
+    
+    server_conn_remove(conn);
+    close(conn->fd);
+    free(conn);
+    return NULL;
+}
+
+static huffman_codetab_t* server_load_preset(const char* filename)
+{
+    chartab_t* sample = NULL;
+    huffman_codetab_t* preset = NULL;
+    FILE* fp = NULL;
+    
+    if (NULL == filename)
+        return huffman_preset_train(NULL);
+    
+    fp = fopen(filename, "rb");
+    if (NULL == fp)
+        return NULL;
+    
+    sample = chartab_read_from_file(fp);
+    fclose(fp);
+    if (NULL == sample)
+        return NULL;
+    
+    preset = huffman_preset_train(sample);
+    chartab_free(sample);
+    return preset;
+}
+
+static int server_listen(const char* socket_path)
+{
+    struct sockaddr_un addr;
+    int fd = -1;
+    
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+        return -1;
+    
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+    
+    if (0 != bind(fd, (struct sockaddr*) &addr, sizeof(addr)) ||
+        0 != listen(fd, 64))
+    {
+        close(fd);
+        return -1;
+    }
+    
+    return fd;
+}
+
+/*
+ * Threads are started with SIGINT and SIGTERM blocked, so the handler
+ * only ever runs on the accepting thread and never inside a worker.
+ */
+static int server_thread_start(
+    pthread_t* tid,
+    void* (*run)(void*),
+    void* arg
+)
+{
+    sigset_t stop, saved;
+    int ret = 0;
+    
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop, &saved);
+    ret = pthread_create(tid, NULL, run, arg);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    return ret;
+}
+
+static void server_accept_loop(
+    server_t* server,
+    int listen_fd,
+    int wake_fd,
+    int max_connections
+)
+{
+    struct pollfd fds[2];
+    char drain[64];
+    
+    while (!server_interrupted)
+    {
+        server_conn_t* conn = NULL;
+        pthread_t tid;
+        int fd = -1, full = 0;
+        
+        /* At the cap, leave callers in the backlog until a slot frees. */
+        pthread_mutex_lock(&server->lock);
+        full = server->connections >= max_connections;
+        pthread_mutex_unlock(&server->lock);
+        
+        fds[0].fd = wake_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = listen_fd;
+        fds[1].events = POLLIN;
+        if (poll(fds, full ? 1 : 2, -1) < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            
+            break;
+        }
+        
+        if (fds[0].revents & POLLIN)
+        {
+            while (0 < read(wake_fd, drain, sizeof(drain)))
+                continue;
+        }
+        
+        if (full || server_interrupted || !(fds[1].revents & POLLIN))
+            continue;
+        
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (EINTR == errno || EAGAIN == errno || ECONNABORTED == errno)
+                continue;
+            
+            break;
+        }
+        
+        conn = (server_conn_t*) malloc(sizeof(server_conn_t));
+        if (NULL == conn)
+        {
+            close(fd);
+            continue;
+        }
+        
+        conn->server = server;
+        conn->fd = fd;
+        server_conn_add(server, conn);
+        if (0 != server_thread_start(&tid, server_connection, conn))
+        {
+            server_conn_remove(conn);
+            close(fd);
+            free(conn);
+            continue;
+        }
+        
+        pthread_detach(tid);
+    }
+}
+
+int huffman_server_run(const huffman_server_config_t* config)
+{
+    server_t server;
+    huffman_codetab_t* preset = NULL;
+    pthread_t* workers = NULL;
+    server_conn_t* conn = NULL;
+    struct sigaction sa, old_int, old_term;
+    int pipe_fds[2];
+    int listen_fd = -1, count = 0, i = 0, max_connections = 0;
+    
+    if (NULL == config || NULL == config->socket_path)
+        return -1;
+    
+    count = config->workers > 0 ?
+        config->workers : HUFFMAN_SERVER_DEFAULT_WORKERS;
+    max_connections = config->max_connections > 0 ?
+        config->max_connections : HUFFMAN_SERVER_DEFAULT_CONNECTIONS;
+    
+    /* Trained once, then shared read-only by every worker context. */
+    preset = server_load_preset(config->training_file);
+    if (NULL == preset)
+        return -2;
+    
+    listen_fd = server_listen(config->socket_path);
+    if (listen_fd < 0)
+    {
+        huffman_codetab_free(preset);
+        return -3;
+    }
+    
+    /* Both ends non-blocking: the loop drains it, wakers never stall. */
+    if (0 != pipe(pipe_fds))
+    {
+        close(listen_fd);
+        unlink(config->socket_path);
+        huffman_codetab_free(preset);
+        return -3;
+    }
+    
+    for (i = 0; i < 2; i++)
+        fcntl(pipe_fds[i], F_SETFL, fcntl(pipe_fds[i], F_GETFL) | O_NONBLOCK);
+    
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+    server_wake_fd = pipe_fds[1];
+    server_interrupted = 0;
+    
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = server_on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+    signal(SIGPIPE, SIG_IGN);
+    
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready, NULL);
+    pthread_cond_init(&server.idle, NULL);
+    server.head = server.tail = NULL;
+    server.conns = NULL;
+    server.preset = preset;
+    server.stopping = 0;
+    server.connections = 0;
+    
+    workers = (pthread_t*) calloc((size_t) count, sizeof(pthread_t));
+    for (i = 0; NULL != workers && i < count; i++)
+    {
+        if (0 != server_thread_start(&workers[i], server_worker, &server))
+            break;
+    }
+    
+    count = i;
+    if (count > 0)
+        server_accept_loop(&server, listen_fd, pipe_fds[0], max_connections);
+    
+    close(listen_fd);
+    unlink(config->socket_path);
+    
+    /* Queued jobs still complete, blocked reads and writes return. */
+    pthread_mutex_lock(&server.lock);
+    server.stopping = 1;
+    pthread_cond_broadcast(&server.ready);
+    for (conn = server.conns; NULL != conn; conn = conn->next)
+        shutdown(conn->fd, SHUT_RDWR);
+    
+    pthread_mutex_unlock(&server.lock);
+    
+    for (i = 0; i < count; i++)
+        pthread_join(workers[i], NULL);
+    
+    pthread_mutex_lock(&server.lock);
+    while (server.connections > 0)
+        pthread_cond_wait(&server.idle, &server.lock);
+    
+    pthread_mutex_unlock(&server.lock);
+    
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    server_wake_fd = -1;
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    
+    pthread_cond_destroy(&server.idle);
+    pthread_cond_destroy(&server.ready);
+    pthread_mutex_destroy(&server.lock);
+    huffman_codetab_free(preset);
+    free(workers);
+    return count > 0 ? 0 : -4;
+}
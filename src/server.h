@@ -0,0 +1,50 @@
+#ifndef ___huffman__server_h___
+#define ___huffman__server_h___
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * Framed request/response protocol spoken over a UNIX stream socket,
+ * integers little endian. A connection carries any number of requests,
+ * each answered in order:
+ *
+ *   request   "HZRQ" op(1) reserved(3) length(4) payload
+ *   response  status(4, signed) length(4) payload
+ *
+ * A compress response is huffman_compress() output, a decompress request
+ * takes the same. Status is 0 or the negative error of the codec.
+ */
+#define HUFFMAN_SERVER_MAGIC            "HZRQ"
+#define HUFFMAN_SERVER_REQUEST_SIZE     12
+#define HUFFMAN_SERVER_RESPONSE_SIZE    8
+
+#define HUFFMAN_SERVER_OP_COMPRESS      1
+#define HUFFMAN_SERVER_OP_DECOMPRESS    2
+
+#define HUFFMAN_SERVER_MAX_PAYLOAD      (64 * 1024 * 1024)
+
+#define HUFFMAN_SERVER_DEFAULT_WORKERS  4
+
+/*
+ * Connections served at once, each holds a thread and up to a payload.
+ * Further callers wait in the listen backlog until one closes.
+ */
+#define HUFFMAN_SERVER_DEFAULT_CONNECTIONS  64
+
+/* Requests a worker takes off the queue at once. */
+#define HUFFMAN_SERVER_BATCH            16
+
+struct huffman_server_config_s
+{
+    const char* socket_path;
+    const char* training_file;
+    int workers;
+    int max_connections;
+};
+
+typedef struct huffman_server_config_s huffman_server_config_t;
+
+int huffman_server_run(const huffman_server_config_t* config);
+
+#endif
@@ -0,0 +1,570 @@
+/*
+ * Round trips of generated inputs through every encoder mode and every
+ * decoder, under each kernel table the CPU supports, plus the in-memory
+ * API, damaged files, the table cache and the legacy bit stream.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitstream.h"
+#include "huffman.h"
+#include "cache.h"
+#include "codec.h"
+#include "dispatch.h"
+#include "record.h"
+
+#define TEST_LARGE_SIZE     (2 * 1024 * 1024 + 3)
+
+struct test_input_s
+{
+    const char* name;
+    uint8_t* data;
+    size_t size;
+};
+
+typedef struct test_input_s test_input_t;
+
+struct test_encoder_s
+{
+    const char* name;
+    int mode;
+    size_t block_size;
+    int reuse_drift;
+    size_t table_cache;
+    int checksum;
+    size_t rle;
+    const char* record;
+};
+
+typedef struct test_encoder_s test_encoder_t;
+
+struct test_decoder_s
+{
+    const char* name;
+    int compact;
+    int threads;
+    int io;
+};
+
+typedef struct test_decoder_s test_decoder_t;
+
+static const test_encoder_t test_encoders[] = {
+    { "stream",         HUFFMAN_MODE_STREAM, 0,      -1, 0, 0, 0,  NULL },
+    { "stream+crc",     HUFFMAN_MODE_STREAM, 0,      -1, 0, 1, 0,  NULL },
+    { "block",          HUFFMAN_MODE_BLOCK,  0,      -1, 8, 0, 0,  NULL },
+    { "block-4k",       HUFFMAN_MODE_BLOCK,  4096,   -1, 0, 0, 0,  NULL },
+    { "block-drift",    HUFFMAN_MODE_BLOCK,  4096,   50, 8, 0, 0,  NULL },
+    { "block-1000+crc", HUFFMAN_MODE_BLOCK,  1000,   -1, 4, 1, 0,  NULL },
+    { "rle-2+crc",      HUFFMAN_MODE_BLOCK,  0,      -1, 8, 1, 2,  NULL },
+    { "rle-16-4k",      HUFFMAN_MODE_BLOCK,  4096,   20, 8, 0, 16, NULL },
+    { "record+crc",     HUFFMAN_MODE_RECORD, 0,      -1, 0, 1, 0,  "4,2,1,1,8" },
+    { "record-1-333",   HUFFMAN_MODE_RECORD, 333,    -1, 0, 0, 0,  "1" }
+};
+
+static const test_decoder_t test_decoders[] = {
+    { "full",    0, 1, HUFFMAN_IO_STDIO },
+    { "compact", 1, 1, HUFFMAN_IO_STDIO },
+    { "threads", 0, 4, HUFFMAN_IO_STDIO },
+    { "pread",   0, 1, HUFFMAN_IO_PREAD },
+    { "uring",   1, 3, HUFFMAN_IO_URING }
+};
+
+#define TEST_ENCODERS (sizeof(test_encoders) / sizeof(test_encoders[0]))
+#define TEST_DECODERS (sizeof(test_decoders) / sizeof(test_decoders[0]))
+
+static int test_failures = 0;
+static int test_passes = 0;
+
+static void test_check(int ok, const char* what, const char* a, const char* b)
+{
+    if (ok)
+    {
+        test_passes += 1;
+        return;
+    }
+    
+    test_failures += 1;
+    printf("[FAIL] %s %s %s (kernels %s)\n", what, a, b,
+           huffman_kernels()->name);
+}
+
+/* xorshift, so every run sees the same inputs. */
+static uint32_t test_random(uint32_t* state)
+{
+    uint32_t x = *state;
+    
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void test_shuffle(uint8_t* data, size_t size, uint32_t* state)
+{
+    size_t i = 0;
+    
+    for (i = size; i > 1; i--)
+    {
+        size_t j = test_random(state) % i;
+        uint8_t t = data[i - 1];
+        
+        data[i - 1] = data[j];
+        data[j] = t;
+    }
+}
+
+static uint8_t* test_alloc(size_t size)
+{
+    uint8_t* data = (uint8_t*) malloc(size > 0 ? size : 1);
+    
+    if (NULL == data)
+    {
+        printf("[FAIL] out of memory\n");
+        exit(1);
+    }
+    
+    return data;
+}
+
+static size_t test_make_inputs(test_input_t* inputs)
+{
+    uint32_t state = 0x9e3779b9;
+    size_t n = 0, i = 0, k = 0, pos = 0;
+    uint8_t* p = NULL;
+    
+    inputs[n].name = "empty";
+    inputs[n].size = 0;
+    inputs[n++].data = test_alloc(0);
+    
+    inputs[n].name = "one-byte";
+    inputs[n].size = 1;
+    inputs[n].data = test_alloc(1);
+    inputs[n++].data[0] = 'x';
+    
+    inputs[n].name = "single-symbol";
+    inputs[n].size = 100000;
+    inputs[n].data = test_alloc(inputs[n].size);
+    memset(inputs[n++].data, 0xab, 100000);
+    
+    inputs[n].name = "two-symbols";
+    inputs[n].size = 65537;
+    p = inputs[n].data = test_alloc(inputs[n].size);
+    for (i = 0; i < inputs[n].size; i++)
+        p[i] = (test_random(&state) & 7) ? 'a' : 'b';
+    n += 1;
+    
+    inputs[n].name = "all-256";
+    inputs[n].size = 256;
+    p = inputs[n].data = test_alloc(256);
+    for (i = 0; i < 256; i++)
+        p[i] = (uint8_t) i;
+    test_shuffle(p, 256, &state);
+    n += 1;
+    
+    inputs[n].name = "uniform";
+    inputs[n].size = 300000;
+    p = inputs[n].data = test_alloc(inputs[n].size);
+    for (i = 0; i < inputs[n].size; i++)
+        p[i] = (uint8_t) test_random(&state);
+    n += 1;
+    
+    /* Fibonacci counts give the deepest possible tree, far past 15 bits. */
+    {
+        size_t fib[28];
+        
+        fib[0] = fib[1] = 1;
+        for (i = 2; i < 28; i++)
+            fib[i] = fib[i - 1] + fib[i - 2];
+        
+        inputs[n].name = "fibonacci";
+        inputs[n].size = 0;
+        for (i = 0; i < 28; i++)
+            inputs[n].size += fib[i];
+        
+        p = inputs[n].data = test_alloc(inputs[n].size);
+        for (i = 0, pos = 0; i < 28; i++)
+        {
+            memset(p + pos, (int) (i * 9), fib[i]);
+            pos += fib[i];
+        }
+        
+        test_shuffle(p, inputs[n].size, &state);
+        n += 1;
+    }
+    
+    inputs[n].name = "runs";
+    inputs[n].size = 400000;
+    p = inputs[n].data = test_alloc(inputs[n].size);
+    for (pos = 0; pos < inputs[n].size; pos += k)
+    {
+        k = 1 + test_random(&state) % (test_random(&state) & 1 ? 4 : 70000);
+        if (k > inputs[n].size - pos)
+            k = inputs[n].size - pos;
+        
+        memset(p + pos, (int) (test_random(&state) % 5), k);
+    }
+    n += 1;
+    
+    inputs[n].name = "records";
+    inputs[n].size = 16 * 20000 + 7;
+    p = inputs[n].data = test_alloc(inputs[n].size);
+    for (i = 0; i < inputs[n].size; i++)
+    {
+        switch (i % 16)
+        {
+        case 0: case 1: case 2: case 3:
+            p[i] = (uint8_t) (i / 16 >> (8 * (i % 16)));
+            break;
+        case 4: case 5:
+            p[i] = (uint8_t) (test_random(&state) % 3);
+            break;
+        default:
+            p[i] = (uint8_t) (test_random(&state) % (1 + i % 16 * 16));
+            break;
+        }
+    }
+    n += 1;
+    
+    /* Skewed bytes over more than one I/O buffer and many blocks. */
+    inputs[n].name = "large";
+    inputs[n].size = TEST_LARGE_SIZE;
+    p = inputs[n].data = test_alloc(inputs[n].size);
+    for (i = 0; i < inputs[n].size; i++)
+    {
+        uint32_t r = test_random(&state);
+        p[i] = (uint8_t) ('a' + (r & 0xffff) % (1 + (r >> 16) % 26));
+    }
+    n += 1;
+    
+    return n;
+}
+
+static void test_options(
+    huffman_options_t* opt,
+    const test_encoder_t* enc,
+    const test_decoder_t* dec
+)
+{
+    huffman_options_init(opt);
+    opt->mode = enc->mode;
+    if (enc->block_size > 0)
+        opt->block_size = enc->block_size;
+    
+    opt->reuse_drift = enc->reuse_drift;
+    opt->table_cache = enc->table_cache;
+    opt->checksum = enc->checksum;
+    opt->rle = enc->rle;
+    if (NULL != enc->record)
+        huffman_record_layout_parse(&opt->record, enc->record);
+    
+    opt->compact = dec->compact;
+    opt->threads = dec->threads;
+    opt->io = dec->io;
+}
+
+static FILE* test_file_of(const uint8_t* data, size_t size)
+{
+    FILE* fp = tmpfile();
+    
+    if (NULL == fp || size != fwrite(data, 1, size, fp))
+    {
+        printf("[FAIL] can not write a temporary file\n");
+        exit(1);
+    }
+    
+    rewind(fp);
+    return fp;
+}
+
+/* Reads fp back from the start, returns 0 when it holds data exactly. */
+static int test_file_equals(FILE* fp, const uint8_t* data, size_t size)
+{
+    uint8_t buf[65536];
+    size_t pos = 0, n = 0;
+    
+    rewind(fp);
+    while (0 < (n = fread(buf, 1, sizeof(buf), fp)))
+    {
+        if (pos + n > size || 0 != memcmp(buf, data + pos, n))
+            return -1;
+        
+        pos += n;
+    }
+    
+    return pos == size ? 0 : -1;
+}
+
+static void test_round_trips(const test_input_t* inputs, size_t count)
+{
+    huffman_options_t opt;
+    size_t i = 0, e = 0, d = 0;
+    
+    for (i = 0; i < count; i++)
+    {
+        for (e = 0; e < TEST_ENCODERS; e++)
+        {
+            FILE* in = test_file_of(inputs[i].data, inputs[i].size);
+            FILE* coded = tmpfile();
+            int ret = 0;
+            
+            test_options(&opt, &test_encoders[e], &test_decoders[0]);
+            ret = huffman_encode_file(in, coded, &opt);
+            test_check(0 == ret, "encode", test_encoders[e].name,
+                       inputs[i].name);
+            
+            for (d = 0; 0 == ret && d < TEST_DECODERS; d++)
+            {
+                FILE* out = tmpfile();
+                
+                test_options(&opt, &test_encoders[e], &test_decoders[d]);
+                rewind(coded);
+                test_check(0 == huffman_decode_file(coded, out, &opt) &&
+                           0 == test_file_equals(out, inputs[i].data,
+                                                 inputs[i].size),
+                           test_decoders[d].name, test_encoders[e].name,
+                           inputs[i].name);
+                fclose(out);
+            }
+            
+            fclose(coded);
+            fclose(in);
+        }
+    }
+}
+
+static void test_memory(const test_input_t* inputs, size_t count)
+{
+    huffman_codetab_t* preset = huffman_preset_train(NULL);
+    huffman_context_t* plain = huffman_context_create(NULL);
+    huffman_context_t* trained = huffman_context_create(preset);
+    size_t i = 0;
+    int c = 0;
+    
+    for (i = 0; i < count; i++)
+    {
+        huffman_context_t* ctx = NULL;
+        size_t cap = huffman_compress_bound(inputs[i].size);
+        size_t coded_size = 0, raw_size = 0;
+        uint8_t* coded = test_alloc(cap);
+        uint8_t* out = test_alloc(inputs[i].size);
+        
+        for (c = 0; c < 2; c++)
+        {
+            ctx = 0 == c ? plain : trained;
+            test_check(0 == huffman_compress(ctx, inputs[i].data,
+                                             inputs[i].size, coded, cap,
+                                             &coded_size) &&
+                       0 == huffman_decompressed_size(coded, coded_size,
+                                                      &raw_size) &&
+                       raw_size == inputs[i].size &&
+                       0 == huffman_decompress(ctx, coded, coded_size, out,
+                                               inputs[i].size, &raw_size) &&
+                       raw_size == inputs[i].size &&
+                       0 == memcmp(out, inputs[i].data, raw_size),
+                       "memory", 0 == c ? "plain" : "preset", inputs[i].name);
+        }
+        
+        free(coded);
+        free(out);
+    }
+    
+    huffman_context_free(trained);
+    huffman_context_free(plain);
+    huffman_codetab_free(preset);
+}
+
+/* A payload coded with one preset must not decode with another. */
+static void test_preset_mismatch(const test_input_t* input)
+{
+    chartab_t* sample = chartab_create(HUFFMAN_ASCII_BYTE_CHARTAB_SIZE);
+    huffman_codetab_t* preset = huffman_preset_train(NULL);
+    huffman_codetab_t* other = NULL;
+    huffman_context_t* enc = huffman_context_create(preset);
+    huffman_context_t* dec = NULL;
+    huffman_context_t* bare = huffman_context_create(NULL);
+    size_t cap = huffman_compress_bound(input->size);
+    size_t coded_size = 0, raw_size = 0;
+    uint8_t* coded = test_alloc(cap);
+    uint8_t* out = test_alloc(input->size);
+    
+    chartab_accumulate(sample, (const uint8_t*) "zzzzzzzzzzzzzzzzqqqq", 20);
+    other = huffman_preset_train(sample);
+    dec = huffman_context_create(other);
+    
+    test_check(NULL != enc && NULL != dec && NULL != bare &&
+               0 == huffman_compress(enc, input->data, input->size, coded,
+                                     cap, &coded_size) &&
+               HUFFMAN_BLOCK_TABLE_PRESET == (coded[8] & 0x0f) &&
+               -13 == huffman_decompress(dec, coded, coded_size, out,
+                                         input->size, &raw_size) &&
+               -13 == huffman_decompress(bare, coded, coded_size, out,
+                                         input->size, &raw_size) &&
+               0 == huffman_decompress(enc, coded, coded_size, out,
+                                       input->size, &raw_size) &&
+               raw_size == input->size &&
+               0 == memcmp(out, input->data, raw_size),
+               "memory", "preset-mismatch", input->name);
+    
+    free(coded);
+    free(out);
+    huffman_context_free(bare);
+    huffman_context_free(dec);
+    huffman_context_free(enc);
+    huffman_codetab_free(other);
+    huffman_codetab_free(preset);
+    chartab_free(sample);
+}
+
+/* Cut or flipped files must fail cleanly, with checksums as -12. */
+static void test_damage(const test_input_t* input)
+{
+    huffman_options_t opt;
+    FILE* in = test_file_of(input->data, input->size);
+    FILE* coded = tmpfile();
+    uint8_t* buf = NULL;
+    long size = 0;
+    int e = 0;
+    
+    for (e = 0; e < 2; e++)
+    {
+        FILE* damaged = NULL;
+        FILE* out = NULL;
+        
+        test_options(&opt, &test_encoders[0 == e ? 1 : 5], &test_decoders[0]);
+        rewind(in);
+        rewind(coded);
+        if (0 != huffman_encode_file(in, coded, &opt))
+        {
+            test_check(0, "encode", "damage", input->name);
+            break;
+        }
+        
+        size = ftell(coded);
+        buf = test_alloc((size_t) size);
+        rewind(coded);
+        if ((size_t) size != fread(buf, 1, (size_t) size, coded))
+            size = 0;
+        
+        /* Truncated anywhere but inside the final header. */
+        damaged = test_file_of(buf, (size_t) size / 2);
+        out = tmpfile();
+        test_check(0 != huffman_decode_file(damaged, out, &opt),
+                   "truncated", test_encoders[0 == e ? 1 : 5].name,
+                   input->name);
+        fclose(damaged);
+        fclose(out);
+        
+        buf[size * 3 / 4] ^= 0x20;
+        damaged = test_file_of(buf, (size_t) size);
+        out = tmpfile();
+        test_check(0 != huffman_decode_file(damaged, out, &opt),
+                   "flipped", test_encoders[0 == e ? 1 : 5].name,
+                   input->name);
+        fclose(damaged);
+        fclose(out);
+        
+        buf[0] = 'X';
+        damaged = test_file_of(buf, (size_t) size);
+        out = tmpfile();
+        test_check(-9 == huffman_decode_file(damaged, out, &opt),
+                   "magic", test_encoders[0 == e ? 1 : 5].name, input->name);
+        fclose(damaged);
+        fclose(out);
+        free(buf);
+    }
+    
+    fclose(coded);
+    fclose(in);
+}
+
+/* The final partial byte has to reach the file on close. */
+static void test_bitstream(void)
+{
+    const char* path = "test_bitstream.tmp";
+    bitstream_t* bs = bitstream_open_write(path);
+    int bits[13] = { 1, 0, 1, 1, 0, 0, 1, 0, 1, 1, 1, 0, 1 };
+    int i = 0, ok = NULL != bs;
+    
+    for (i = 0; ok && i < 13; i++)
+        ok = 0 == bitstream_set_bit(bs, bits[i] ? BINCODE_1 : BINCODE_0);
+    
+    ok = ok && 0 == bitstream_write_bits(bs, 0xb, 4);
+    ok = ok && 0 == bitstream_close(bs);
+    
+    bs = ok ? bitstream_open_read(path) : NULL;
+    for (i = 0; NULL != bs && i < 13; i++)
+        ok = ok && (bits[i] ? BINCODE_1 : BINCODE_0) == bitstream_get_bit(bs);
+    
+    /* 17 bits, the last one alone in the third byte. */
+    ok = ok && NULL != bs &&
+        BINCODE_1 == bitstream_get_bit(bs) &&
+        BINCODE_0 == bitstream_get_bit(bs) &&
+        BINCODE_1 == bitstream_get_bit(bs) &&
+        BINCODE_1 == bitstream_get_bit(bs);
+    
+    if (NULL != bs)
+        bitstream_close(bs);
+    
+    remove(path);
+    test_check(ok, "bitstream", "close", "flush");
+}
+
+/* A second table under a key already cached must replace the first. */
+static void test_table_cache(void)
+{
+    huffman_table_cache_t* cache = huffman_table_cache_create(4, 256);
+    huffman_codetab_t* ct = huffman_codetab_create(256);
+    int first = -1, second = -1, ok = NULL != cache && NULL != ct;
+    
+    if (ok)
+    {
+        ct->lengths['a'] = 1;
+        first = huffman_table_cache_insert(cache, 42, ct);
+        huffman_table_cache_insert(cache, 7, ct);
+        ct->lengths['a'] = 2;
+        second = huffman_table_cache_insert(cache, 42, ct);
+    }
+    
+    ok = ok && first >= 0 && first == second &&
+        first == huffman_table_cache_find(cache, 42) &&
+        2 == huffman_table_cache_get(cache, first)->lengths['a'];
+    
+    huffman_codetab_free(ct);
+    huffman_table_cache_free(cache);
+    test_check(ok, "cache", "insert", "same key");
+}
+
+int main(void)
+{
+    test_input_t inputs[16];
+    const huffman_kernels_t* list = NULL;
+    size_t count = 0, kernels = 0, i = 0;
+    
+    huffman_kernels_init();
+    count = test_make_inputs(inputs);
+    list = huffman_kernels_list(&kernels);
+    
+    for (i = 0; i < kernels; i++)
+    {
+        if (0 != huffman_kernels_select(list[i].name))
+            continue;
+        
+        printf("kernels %s\n", list[i].name);
+        test_round_trips(inputs, count);
+        test_memory(inputs, count);
+        test_preset_mismatch(&inputs[1]);
+        test_damage(&inputs[count - 1]);
+    }
+    
+    huffman_kernels_init();
+    test_table_cache();
+    test_bitstream();
+    
+    for (i = 0; i < count; i++)
+        free(inputs[i].data);
+    
+    printf("%d passed, %d failed\n", test_passes, test_failures);
+    return 0 == test_failures ? 0 : 1;
+}
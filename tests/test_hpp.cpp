@@ -0,0 +1,113 @@
+/*
+ * Round trips through the C++ wrapper at several code length limits and
+ * lookup widths, checked against the C in-memory API both ways.
+ */
+#include "huffman.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+int failures = 0;
+int passes = 0;
+
+std::vector<std::vector<uint8_t>> make_inputs()
+{
+    std::vector<std::vector<uint8_t>> inputs;
+    std::vector<uint8_t> all(256 * 4);
+    std::vector<uint8_t> fib;
+    std::vector<uint8_t> text(1 << 20);
+    std::minstd_rand rng(1);
+
+    inputs.emplace_back();
+    inputs.emplace_back(100000, uint8_t(7));
+
+    for (std::size_t i = 0; i < all.size(); i++)
+        all[i] = uint8_t(i);
+    inputs.push_back(all);
+
+    /* Fibonacci counts, deeper than any of the length limits. */
+    for (std::size_t i = 0, a = 1, b = 1; i < 26; i++, b = a + b, a = b - a)
+        fib.insert(fib.end(), a, uint8_t(i * 3));
+    std::shuffle(fib.begin(), fib.end(), rng);
+    inputs.push_back(fib);
+
+    for (auto& c : text)
+    {
+        uint32_t r = uint32_t(rng());
+        c = uint8_t(' ' + (r & 0xffff) % (1 + (r >> 16) % 64));
+    }
+    inputs.push_back(text);
+    return inputs;
+}
+
+template <int MaxLength, int LookupBits>
+void round_trip(const std::vector<uint8_t>& in)
+{
+    huffman::basic_encoder<MaxLength> enc;
+    huffman::basic_decoder<MaxLength, LookupBits> dec;
+    std::vector<uint8_t> coded(huffman::compress_bound(in.size()));
+    std::vector<uint8_t> out(in.size());
+    std::vector<uint8_t> back(in.size() + 1);
+    huffman_context_t* ctx = huffman_context_create(nullptr);
+    std::size_t n = 0;
+    bool ok = nullptr != ctx;
+
+    try
+    {
+        auto c = enc.compress(in, coded);
+        auto d = dec.decompress(c, out);
+
+        ok = ok && d.size() == in.size() &&
+            std::equal(in.begin(), in.end(), out.begin());
+
+        /* The C decoder reads whatever the wrapper wrote. */
+        ok = ok && 0 == huffman_decompress(ctx, c.data(), c.size(),
+                                           back.data(), back.size(), &n) &&
+            n == in.size() && std::equal(in.begin(), in.end(), back.begin());
+
+        /* C output has 15 bit codes, only the widest decoder takes all. */
+        ok = ok && 0 == huffman_compress(ctx, in.data(), in.size(),
+                                         coded.data(), coded.size(), &n);
+        if (ok && HUFFMAN_MAX_CODE_LENGTH == MaxLength)
+            ok = dec.decompress(huffman::const_bytes(coded.data(), n),
+                                out).size() == in.size() &&
+                std::equal(in.begin(), in.end(), out.begin());
+    }
+    catch (const huffman::error& e)
+    {
+        std::printf("[FAIL] %s\n", e.what());
+        ok = false;
+    }
+
+    huffman_context_free(ctx);
+    if (ok)
+        passes++;
+    else
+    {
+        failures++;
+        std::printf("[FAIL] hpp M=%d L=%d size %zu\n", MaxLength, LookupBits,
+                    in.size());
+    }
+}
+
+}
+
+int main()
+{
+    for (const auto& in : make_inputs())
+    {
+        round_trip<15, 11>(in);
+        round_trip<15, 15>(in);
+        round_trip<12, 8>(in);
+        round_trip<8, 8>(in);
+        round_trip<11, 1>(in);
+    }
+
+    std::printf("hpp: %d passed, %d failed\n", passes, failures);
+    return 0 == failures ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+/*
+ * Throughput gate: runs the bench stages over generated text-like data
+ * and fails when a stage is slower than HUFFMAN_TEST_SPEED_FLOOR times
+ * the MB/s recorded in the baseline file. "-w FILE" records a new one.
+ * Baselines only mean something on the machine that recorded them, so
+ * the gate is skipped without one, or when it was taken with other
+ * kernels than the ones this CPU dispatches to.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "dispatch.h"
+
+#define TEST_SPEED_SIZE             (16 * 1024 * 1024)
+#define TEST_SPEED_ITERATIONS       5
+#define HUFFMAN_TEST_SPEED_FLOOR    0.5
+
+static uint8_t* test_speed_data(size_t size)
+{
+    uint8_t* data = (uint8_t*) malloc(size);
+    uint32_t x = 0x2545f491;
+    size_t i = 0;
+    
+    if (NULL == data)
+        return NULL;
+    
+    /* Roughly English letter frequencies, about 4.5 bits per byte. */
+    for (i = 0; i < size; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        data[i] = (uint8_t) (' ' + (x & 0xffff) % (1 + (x >> 16) % 64));
+    }
+    
+    return data;
+}
+
+static double test_speed_mbps(const huffman_bench_result_t* result, int stage)
+{
+    if (result->seconds[stage] <= 0.0)
+        return 0.0;
+    
+    return (double) result->bytes / result->seconds[stage] / 1e6;
+}
+
+static int test_speed_write(const char* path, const huffman_bench_result_t* r)
+{
+    FILE* fp = fopen(path, "w");
+    int stage = 0;
+    
+    if (NULL == fp)
+        return -1;
+    
+    fprintf(fp, "# stage MB/s, kernels %s\n", huffman_kernels()->name);
+    for (stage = 0; stage < HUFFMAN_BENCH_STAGES; stage++)
+        fprintf(fp, "%s %.1f\n", huffman_bench_stage_name(stage),
+                test_speed_mbps(r, stage));
+    
+    return 0 == fclose(fp) ? 0 : -1;
+}
+
+static int test_speed_check(const char* path, const huffman_bench_result_t* r)
+{
+    char line[256];
+    char name[64];
+    char seen[HUFFMAN_BENCH_STAGES];
+    FILE* fp = fopen(path, "r");
+    double baseline = 0.0, measured = 0.0;
+    int stage = 0, failed = 0, matched = 0;
+    
+    if (NULL == fp)
+    {
+        printf("[SKIP] no baseline '%s', record one with -w\n", path);
+        return 0;
+    }
+    
+    if (NULL == fgets(line, sizeof(line), fp) ||
+        1 != sscanf(line, "# stage MB/s, kernels %63s", name) ||
+        strcmp(name, huffman_kernels()->name))
+    {
+        printf("[SKIP] baseline '%s' was not recorded with kernels %s\n",
+               path, huffman_kernels()->name);
+        fclose(fp);
+        return 0;
+    }
+    
+    memset(seen, 0, sizeof(seen));
+    while (NULL != fgets(line, sizeof(line), fp))
+    {
+        if ('#' == line[0] || 2 != sscanf(line, "%63s %lf", name, &baseline))
+            continue;
+        
+        for (stage = 0; stage < HUFFMAN_BENCH_STAGES; stage++)
+        {
+            if (strcmp(name, huffman_bench_stage_name(stage)))
+                continue;
+            
+            if (!seen[stage])
+                matched += 1;
+            
+            seen[stage] = 1;
+            measured = test_speed_mbps(r, stage);
+            printf("%-10s %10.1f MB/s, baseline %10.1f%s\n", name, measured,
+                   baseline, measured < baseline * HUFFMAN_TEST_SPEED_FLOOR ?
+                       "  [FAIL]" : "");
+            if (measured < baseline * HUFFMAN_TEST_SPEED_FLOOR)
+                failed += 1;
+        }
+    }
+    
+    fclose(fp);
+    
+    /* A stage the baseline lost would otherwise never be gated. */
+    if (matched < HUFFMAN_BENCH_STAGES)
+    {
+        printf("[FAIL] baseline '%s' has %d of %d stages, record a new one\n",
+               path, matched, HUFFMAN_BENCH_STAGES);
+        failed += 1;
+    }
+    
+    return failed;
+}
+
+int main(int argc, const char* argv[])
+{
+    huffman_bench_config_t config;
+    huffman_bench_result_t result;
+    const char* path = NULL;
+    uint8_t* data = NULL;
+    int write = 0, ret = 0;
+    
+    if (3 == argc && !strcmp("-w", argv[1]))
+    {
+        write = 1;
+        path = argv[2];
+    }
+    else if (2 == argc)
+        path = argv[1];
+    else
+    {
+        printf("usage: %s [-w] BASELINE\n", argv[0]);
+        return 2;
+    }
+    
+    huffman_kernels_init();
+    data = test_speed_data(TEST_SPEED_SIZE);
+    if (NULL == data)
+        return 2;
+    
+    config.block_size = 0;
+    config.iterations = TEST_SPEED_ITERATIONS;
+    ret = huffman_bench_run(&config, data, TEST_SPEED_SIZE, &result);
+    free(data);
+    if (0 != ret)
+    {
+        printf("[FAIL] benchmark failed (%d)\n", ret);
+        return 1;
+    }
+    
+    if (write)
+        return 0 == test_speed_write(path, &result) ? 0 : 2;
+    
+    return 0 == test_speed_check(path, &result) ? 0 : 1;
+}